@@ -25,25 +25,317 @@
 #ifndef MITERATOR_C
 #define MITERATOR_C
 
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef MIT_THREADS
+#include <pthread.h>
+#endif
+
+#ifdef MIT_POSIX
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#endif
+
+#ifdef MIT_UCONTEXT
+#include <ucontext.h>
+#endif
 
 #include "mIterator.h"
 
-struct mit_t {
-  int finite;
-  mit_status_t status;
+/* built-in iterators are tagged so the core can call them directly */
+enum _mit_kind_t {
+  _MIT_KIND_USER = 0,
+  _MIT_KIND_PIPE,
+  _MIT_KIND_CHAIN,
+  _MIT_KIND_ARRAY,
+  _MIT_KIND_RANGE,
+  _MIT_KIND_LINES,
+  _MIT_KIND_FD,
+  _MIT_KIND_TAKE,
+  _MIT_KIND_WINDOW,
+  _MIT_KIND_MERGE,
+  _MIT_KIND_SORT,
+  _MIT_KIND_GROUP,
+  _MIT_KIND_JOIN,
+  _MIT_KIND_PREFETCH,
+  _MIT_KIND_PAR
+};
 
+/* fields used for every value come first so they share a cache line */
+struct mit_t {
   mit_result_t value;
-  mit_result_t next;  /* cached peek value */
-  int next_set;       /* is the next value cached */
-
+  mit_status_t status;
+  unsigned char kind;
+  unsigned char next_set; /* is the next value cached */
+  unsigned char finite;
+  unsigned char embedded; /* stored in caller memory by mit_init */
   void *ctx;
-  mit_free_fn_t freefn;
   mit_next_fn_t nextfn;
+  mit_next_sized_fn_t nextsizedfn;    /* replaces nextfn for sized sources */
+  mit_batch_fn_t batchfn;
+
+  mit_batch_sized_fn_t batchsizedfn;  /* replaces batchfn for sized sources */
+  mit_skip_fn_t skipfn;
+  mit_size_fn_t sizefn;
+  mit_fd_fn_t fdfn;   /* descriptor a pending iterator is waiting on */
+  mit_free_fn_t freefn;
+  mit_arena_t *arena; /* arena the iterator was allocated from, if any */
+  unsigned char sized; /* values have a length, even when it is 0 */
+
+#ifdef MIT_STATS
+  mit_stats_t stats;
+#endif
 };
 
-mit_t *mit_new(mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
-  mit_t *mit = calloc(1, sizeof(mit_t));
+/*********
+ * stats *
+ ********/
+
+#ifdef MIT_STATS_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+static unsigned long long _mit_cycles(void) {
+  unsigned int lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((unsigned long long)hi << 32) | lo;
+}
+#else
+#include <time.h>
+static unsigned long long _mit_cycles(void) {
+  return (unsigned long long)clock();
+}
+#endif
+#define _MIT_CYCLES_BEGIN() unsigned long long _mit_start = _mit_cycles()
+#define _MIT_CYCLES_END(total) ((total) += _mit_cycles() - _mit_start)
+#else
+#define _MIT_CYCLES_BEGIN() ((void)0)
+#define _MIT_CYCLES_END(total) ((void)0)
+#endif
+
+#ifdef MIT_STATS
+#define _MIT_STAT(mit, field, n) ((mit)->stats.field += (n))
+#define _MIT_STAT_BEGIN() _MIT_CYCLES_BEGIN()
+#define _MIT_STAT_END(mit, field) \
+  do { (mit)->stats.field++; _MIT_CYCLES_END((mit)->stats.cycles); } while (0)
+#else
+#define _MIT_STAT(mit, field, n) ((void)0)
+#define _MIT_STAT_BEGIN() ((void)0)
+#define _MIT_STAT_END(mit, field) ((void)0)
+#endif
+
+/**************
+ * allocation *
+ *************/
+
+#define _MIT_CACHE_LINE 64
+#define _MIT_ALIGNMENT sizeof(union { long double ld; long long ll; void *p; })
+#define _MIT_ROUND_UP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+/* counters that may be updated from a background thread */
+#ifdef MIT_THREADS
+#define _MIT_INC(var) __atomic_add_fetch(&(var), 1, __ATOMIC_RELAXED)
+#define _MIT_DEC(var) __atomic_sub_fetch(&(var), 1, __ATOMIC_ACQ_REL)
+#else
+#define _MIT_INC(var) (++(var))
+#define _MIT_DEC(var) (--(var))
+#endif
+
+/* adapter contexts are stored directly after their iterator */
+#define _MIT_NODE_SIZE _MIT_ROUND_UP(sizeof(mit_t), _MIT_ALIGNMENT)
+
+static mit_malloc_fn_t _mit_mallocfn = malloc;
+static mit_realloc_fn_t _mit_reallocfn = realloc;
+static mit_dealloc_fn_t _mit_deallocfn = free;
+static size_t _mit_alloc_count = 0;
+static size_t _mit_dealloc_count = 0;
+
+void mit_set_allocator(mit_malloc_fn_t mallocfn,
+    mit_realloc_fn_t reallocfn, mit_dealloc_fn_t deallocfn) {
+  _mit_mallocfn = mallocfn ? mallocfn : malloc;
+  _mit_reallocfn = reallocfn ? reallocfn : realloc;
+  _mit_deallocfn = deallocfn ? deallocfn : free;
+}
+
+void mit_alloc_counts(size_t *allocs, size_t *deallocs) {
+  if (allocs) { *allocs = _mit_alloc_count; }
+  if (deallocs) { *deallocs = _mit_dealloc_count; }
+}
+
+static void *_mit_malloc(size_t size) {
+  void *ptr = _mit_mallocfn(size);
+  if (ptr) { _MIT_INC(_mit_alloc_count); }
+  return ptr;
+}
+
+/* growing from NULL counts as an allocation */
+static void *_mit_realloc(void *ptr, size_t size) {
+  void *new = _mit_reallocfn(ptr, size);
+  if (new && ptr == NULL) { _MIT_INC(_mit_alloc_count); }
+  return new;
+}
+
+static void _mit_dealloc(void *ptr) {
+  if (ptr) {
+    _MIT_INC(_mit_dealloc_count);
+    _mit_deallocfn(ptr);
+  }
+}
+
+struct _mit_arena_block_t {
+  struct _mit_arena_block_t *next;
+  size_t size;
+  size_t used;
+  unsigned char data[];
+};
+
+struct mit_arena_t {
+  struct _mit_arena_block_t *first;
+  struct _mit_arena_block_t *current;
+  size_t live;        /* iterators allocated and not yet freed */
+  int fixed;          /* caller-owned memory that cannot grow */
+};
+
+static struct _mit_arena_block_t *_mit_arena_block_new(size_t size) {
+  struct _mit_arena_block_t *block;
+  if ((block = _mit_malloc(sizeof(*block) + size)) != NULL) {
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+  }
+  return block;
+}
+
+mit_arena_t *mit_arena_new(size_t size) {
+  mit_arena_t *arena = _mit_malloc(sizeof(mit_arena_t));
+  if (arena == NULL) { return NULL; }
+  if ((arena->first = _mit_arena_block_new(size)) == NULL) {
+    _mit_dealloc(arena);
+    return NULL;
+  }
+  arena->current = arena->first;
+  arena->live = 0;
+  arena->fixed = 0;
+  return arena;
+}
+
+mit_arena_t *mit_arena_init(void *buf, size_t size) {
+  size_t header = _MIT_ROUND_UP(sizeof(mit_arena_t), _MIT_ALIGNMENT)
+      + sizeof(struct _mit_arena_block_t);
+  size_t pad = _MIT_ROUND_UP((uintptr_t)buf, _MIT_ALIGNMENT) - (uintptr_t)buf;
+  mit_arena_t *arena = (mit_arena_t *)((unsigned char *)buf + pad);
+  if (size < pad + header) { return NULL; }
+  arena->first = (struct _mit_arena_block_t *)((unsigned char *)arena
+          + _MIT_ROUND_UP(sizeof(mit_arena_t), _MIT_ALIGNMENT));
+  arena->first->next = NULL;
+  arena->first->size = size - pad - header;
+  arena->first->used = 0;
+  arena->current = arena->first;
+  arena->live = 0;
+  arena->fixed = 1;
+  return arena;
+}
+
+void mit_arena_free(mit_arena_t *arena) {
+  if (arena && !arena->fixed) {
+    struct _mit_arena_block_t *block = arena->first;
+    while (block) {
+      struct _mit_arena_block_t *next = block->next;
+      _mit_dealloc(block);
+      block = next;
+    }
+    _mit_dealloc(arena);
+  }
+}
+
+static void *_mit_arena_alloc(mit_arena_t *arena, size_t size) {
+  struct _mit_arena_block_t *block = arena->current;
+  for (;;) {
+    /* align the absolute address so nodes start on a cache line, unless
+     * space in caller memory is more important */
+    size_t align = arena->fixed ? _MIT_ALIGNMENT : _MIT_CACHE_LINE;
+    size_t base = (size_t)(uintptr_t)block->data;
+    size_t offset = _MIT_ROUND_UP(base + block->used, align) - base;
+    if (offset + size <= block->size) {
+      block->used = offset + size;
+      arena->current = block;
+      return block->data + offset;
+    }
+    if (block->next == NULL) {
+      size_t bsize = arena->first->size;
+      if (arena->fixed) { return NULL; }
+      if (bsize < size + _MIT_CACHE_LINE) { bsize = size + _MIT_CACHE_LINE; }
+      if ((block->next = _mit_arena_block_new(bsize)) == NULL) { return NULL; }
+    }
+    block = block->next;
+  }
+}
+
+static void _mit_arena_reset(mit_arena_t *arena) {
+  struct _mit_arena_block_t *block;
+  for (block = arena->first; block; block = block->next) { block->used = 0; }
+  arena->current = arena->first;
+}
+
+static mit_t *_mit_node_new(mit_arena_t *arena, size_t ctxsize) {
+  size_t size = _MIT_NODE_SIZE + ctxsize;
+  mit_t *mit = arena ? _mit_arena_alloc(arena, size) : _mit_malloc(size);
+  if (mit != NULL) {
+    memset(mit, 0, size);
+    if ((mit->arena = arena) != NULL) { _MIT_INC(arena->live); }
+    if (ctxsize) { mit->ctx = (unsigned char *)mit + _MIT_NODE_SIZE; }
+  }
+  return mit;
+}
+
+/************
+ * iterator *
+ ***********/
+
+static mit_status_t _mit_pipe_next(void *ctx, void **result, size_t *len);
+static mit_status_t _mit_chain_next(void *ctx, void **result, size_t *len);
+static mit_status_t _mit_array_next(void *ctx, void **result);
+static mit_status_t _mit_range_next(void *ctx, void **result);
+
+/* built-in adapters and sources are called directly so the compiler can
+ * inline them instead of going through the function pointers */
+static mit_status_t _mit_call_builtin(mit_t *mit, void **value, size_t *len) {
+  switch (mit->kind) {
+    case _MIT_KIND_PIPE:
+      return _mit_pipe_next(mit->ctx, value, len);
+    case _MIT_KIND_CHAIN:
+      return _mit_chain_next(mit->ctx, value, len);
+    case _MIT_KIND_ARRAY:
+      return _mit_array_next(mit->ctx, value);
+    case _MIT_KIND_RANGE:
+      return _mit_range_next(mit->ctx, value);
+    default:
+      if (mit->nextsizedfn) { return mit->nextsizedfn(mit->ctx, value, len); }
+      return mit->nextfn(mit->ctx, value);
+  }
+}
+
+/* user callbacks are tested first and called in place; they are the most
+ * common source and gain nothing from the switch */
+#define _mit_call_next(mit, value, len) \
+  ((mit)->kind == _MIT_KIND_USER && (mit)->nextsizedfn == NULL \
+   ? (mit)->nextfn((mit)->ctx, (value)) \
+   : _mit_call_builtin((mit), (value), (len)))
+
+/* a pending iterator has no value yet but may produce more later */
+#define _mit_is_live(mit) \
+  ((mit)->status == MIT_OK || (mit)->status == MIT_PENDING)
+
+mit_t *mit_new_in(mit_arena_t *arena,
+    mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
+  mit_t *mit = _mit_node_new(arena, 0);
   if (mit != NULL) {
     mit->ctx = ctx;
     mit->nextfn = nextfn;
@@ -52,8 +344,59 @@ mit_t *mit_new(mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
   return mit;
 }
 
+mit_t *mit_new(mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
+  return mit_new_in(NULL, nextfn, ctx, freefn);
+}
+
+mit_t *mit_finite_new_in(mit_arena_t *arena,
+    mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
+  mit_t *mit = mit_new_in(arena, nextfn, ctx, freefn);
+  if (mit != NULL) {
+    mit->finite = 1;
+  }
+  return mit;
+}
+
 mit_t *mit_finite_new(mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
-  mit_t *mit = mit_new(nextfn, ctx, freefn);
+  return mit_finite_new_in(NULL, nextfn, ctx, freefn);
+}
+
+/* storage handed out by the caller must be able to hold any iterator */
+typedef char _mit_storage_fits[sizeof(mit_t) <= MIT_STORAGE_SIZE ? 1 : -1];
+
+mit_t *mit_init(mit_storage_t *storage,
+    mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
+  mit_t *mit = (mit_t *)storage;
+  memset(mit, 0, sizeof(mit_t));
+  mit->embedded = 1;
+  mit->ctx = ctx;
+  mit->nextfn = nextfn;
+  mit->freefn = freefn;
+  return mit;
+}
+
+mit_t *mit_finite_init(mit_storage_t *storage,
+    mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
+  mit_t *mit = mit_init(storage, nextfn, ctx, freefn);
+  mit->finite = 1;
+  return mit;
+}
+
+mit_t *mit_sized_new(mit_next_sized_fn_t nextfn,
+    void *ctx, mit_free_fn_t freefn) {
+  mit_t *mit = _mit_node_new(NULL, 0);
+  if (mit != NULL) {
+    mit->ctx = ctx;
+    mit->nextsizedfn = nextfn;
+    mit->freefn = freefn;
+    mit->sized = 1;
+  }
+  return mit;
+}
+
+mit_t *mit_finite_sized_new(mit_next_sized_fn_t nextfn,
+    void *ctx, mit_free_fn_t freefn) {
+  mit_t *mit = mit_sized_new(nextfn, ctx, freefn);
   if (mit != NULL) {
     mit->finite = 1;
   }
@@ -62,28 +405,72 @@ mit_t *mit_finite_new(mit_next_fn_t nextfn, void *ctx, mit_free_fn_t freefn) {
 
 void mit_free(mit_t *mit) {
   if (mit) {
+    mit_arena_t *arena = mit->arena;
     if (mit->freefn) {
       mit->freefn(mit->ctx);
     }
-    free(mit);
+    if (mit->embedded) {
+      /* the caller owns the memory */
+    } else if (arena == NULL) {
+      _mit_dealloc(mit);
+    } else if (_MIT_DEC(arena->live) == 0) {
+      /* the whole pipeline is gone, recycle the arena */
+      _mit_arena_reset(arena);
+    }
   }
 }
 
+void mit_fini(mit_t *mit) {
+  mit_free(mit);
+}
+
+void mit_set_batchfn(mit_t *mit, mit_batch_fn_t batchfn) {
+  mit->batchfn = batchfn;
+}
+
+void mit_set_batch_sizedfn(mit_t *mit, mit_batch_sized_fn_t batchfn) {
+  mit->batchsizedfn = batchfn;
+}
+
+void mit_set_skipfn(mit_t *mit, mit_skip_fn_t skipfn) {
+  mit->skipfn = skipfn;
+}
+
+void mit_set_sizefn(mit_t *mit, mit_size_fn_t sizefn) {
+  mit->sizefn = sizefn;
+}
+
+void mit_set_fdfn(mit_t *mit, mit_fd_fn_t fdfn) {
+  mit->fdfn = fdfn;
+}
+
 mit_result_t *mit_peek(mit_t *mit) {
   /* ensure result is always a valid pointer */
-  if (!mit_is_ready(mit) || mit->next_set) {
+  if (!_mit_is_live(mit) || mit->next_set) {
+    _MIT_STAT(mit, peek_hits, mit->next_set);
     return &mit->value;
   } else {
-    switch ((mit->value.status = mit->nextfn(mit->ctx, &mit->value.value))) {
+    _MIT_STAT_BEGIN();
+    mit->value.status = _mit_call_next(mit, &mit->value.value, &mit->value.len);
+    _MIT_STAT_END(mit, calls);
+    switch (mit->value.status) {
       case MIT_EXHAUSTED:
         mit->value.value = NULL;
+        mit->value.len = 0;
       /* fall through */
       case MIT_OK:
         mit->next_set = 1;
         return &mit->value;
+      case MIT_PENDING:
+        /* nothing is cached, the next call asks the source again */
+        mit->value.value = NULL;
+        mit->value.len = 0;
+        return &mit->value;
       default:
+        _MIT_STAT(mit, errors, 1);
         mit->status = mit->value.status = MIT_ERROR;
         mit->value.value = NULL;
+        mit->value.len = 0;
         return &mit->value;
     }
   }
@@ -93,19 +480,167 @@ mit_result_t *mit_next(mit_t *mit) {
   mit_peek(mit);
   mit->status = mit->value.status;
   mit->next_set = 0; /* indicate the value has been consumed */
+  _MIT_STAT(mit, yielded, mit->status == MIT_OK);
   return &mit->value;
 }
 
-mit_status_t mit_skip(mit_t *mit, size_t n) {
-  while (n-- && mit_next(mit)->status == MIT_OK);
+/* skip up to n values, storing the number actually skipped */
+static mit_status_t _mit_skip(mit_t *mit, size_t n, size_t *skipped) {
+  size_t done = 0;
+  if (n > 0 && mit->next_set && mit_next(mit)->status == MIT_OK) {
+    done++;
+  }
+  if (mit->skipfn && done < n && _mit_is_live(mit)) {
+    size_t count = 0;
+    mit_status_t status = mit->skipfn(mit->ctx, n - done, &count);
+    done += count;
+    if (status == MIT_OK) {
+      /* clear a pending status left by an earlier call */
+      mit->status = MIT_OK;
+    } else {
+      mit->status = mit->value.status =
+              status == MIT_EXHAUSTED || status == MIT_PENDING
+              ? status : MIT_ERROR;
+      mit->value.value = NULL;
+      mit->value.len = 0;
+    }
+  } else {
+    while (done < n && mit_next(mit)->status == MIT_OK) { done++; }
+  }
+  *skipped = done;
   return mit_status(mit);
 }
 
+mit_status_t mit_skip(mit_t *mit, size_t n) {
+  size_t skipped;
+  return _mit_skip(mit, n, &skipped);
+}
+
+int mit_size_hint(mit_t *mit, size_t *remaining) {
+  size_t cached = 0, rest;
+  if (mit->next_set) {
+    if (mit->value.status != MIT_OK) {
+      *remaining = 0;
+      return 1;
+    }
+    cached = 1;
+  } else if (!_mit_is_live(mit)) {
+    *remaining = 0;
+    return 1;
+  }
+  if (mit->sizefn == NULL || !mit->sizefn(mit->ctx, &rest)) { return 0; }
+  *remaining = cached + rest;
+  return 1;
+}
+
 mit_result_t *mit_nth(mit_t *mit, size_t n) {
   mit_skip(mit, n);
   return mit_next(mit);
 }
 
+/* values returned through storage the iterator reuses on every call, which a
+ * batch pulled one value at a time would overwrite */
+static int _mit_values_transient(mit_t *mit) {
+  switch (mit->kind) {
+    case _MIT_KIND_WINDOW:
+    case _MIT_KIND_GROUP:
+    case _MIT_KIND_JOIN:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static mit_status_t _mit_scalar_batch(mit_t *mit,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  mit_status_t status = MIT_OK;
+  size_t i = 0, len;
+  if (mit->kind == _MIT_KIND_USER && mit->nextsizedfn == NULL) {
+    /* plain callbacks have no lengths to collect */
+    while (i < n) {
+      _MIT_STAT_BEGIN();
+      status = mit->nextfn(mit->ctx, &values[i]);
+      _MIT_STAT_END(mit, calls);
+      if (status != MIT_OK) { break; }
+      if (lens) { lens[i] = 0; }
+      ++i;
+    }
+    *count = i;
+    return status;
+  }
+  if (_mit_values_transient(mit)) { n = 1; }
+  while (i < n) {
+    _MIT_STAT_BEGIN();
+    len = 0;
+    status = _mit_call_next(mit, &values[i], &len);
+    if (lens) { lens[i] = len; }
+    _MIT_STAT_END(mit, calls);
+    if (status != MIT_OK) { break; }
+    ++i;
+  }
+  *count = i;
+  return status;
+}
+
+size_t mit_next_batch_sized(mit_t *mit,
+    void **values, size_t *lens, size_t n) {
+  mit_status_t status;
+  size_t count = 0;
+
+  if (n == 0) { return 0; }
+  if (mit->next_set) {
+    /* hand out the cached peek value by itself; pulling more could
+     * invalidate it for sources that reuse their storage */
+    mit_next(mit);
+    if (mit->value.status != MIT_OK) { return 0; }
+    values[0] = mit->value.value;
+    if (lens) { lens[0] = mit->value.len; }
+    return 1;
+  }
+  if (!_mit_is_live(mit)) { return 0; }
+
+  do {
+    if (mit->batchsizedfn) {
+      _MIT_STAT_BEGIN();
+      status = mit->batchsizedfn(mit->ctx, values, lens, n, &count);
+      _MIT_STAT_END(mit, batches);
+    } else if (mit->batchfn && (lens == NULL || mit->nextsizedfn == NULL)) {
+      _MIT_STAT_BEGIN();
+      status = mit->batchfn(mit->ctx, values, n, &count);
+      _MIT_STAT_END(mit, batches);
+      if (lens) { memset(lens, 0, count * sizeof(size_t)); }
+    } else {
+      status = _mit_scalar_batch(mit, values, lens, n, &count);
+    }
+  } while (status == MIT_OK && count == 0);
+
+  _MIT_STAT(mit, yielded, count);
+  switch (status) {
+    case MIT_OK:
+      mit->status = mit->value.status = MIT_OK;
+      mit->value.value = values[count - 1];
+      mit->value.len = lens ? lens[count - 1] : 0;
+      break;
+    case MIT_EXHAUSTED:
+    case MIT_PENDING:
+      mit->status = mit->value.status = status;
+      mit->value.value = NULL;
+      mit->value.len = 0;
+      break;
+    default:
+      _MIT_STAT(mit, errors, 1);
+      mit->status = mit->value.status = MIT_ERROR;
+      mit->value.value = NULL;
+      mit->value.len = 0;
+      break;
+  }
+  return count;
+}
+
+size_t mit_next_batch(mit_t *mit, void **values, size_t n) {
+  return mit_next_batch_sized(mit, values, NULL, n);
+}
+
 mit_status_t mit_status(mit_t *mit) {
   return mit->status;
 }
@@ -122,46 +657,186 @@ int mit_is_error(mit_t *mit) {
   return mit->status == MIT_ERROR;
 }
 
+int mit_is_pending(mit_t *mit) {
+  return mit->status == MIT_PENDING;
+}
+
+int mit_pending_fd(mit_t *mit) {
+  return mit->fdfn ? mit->fdfn(mit->ctx) : -1;
+}
+
 int mit_is_finite(mit_t *mit) {
   return mit->finite;
 }
 
+int mit_is_sized(mit_t *mit) {
+  return mit->sized;
+}
+
 void *mit_ctx(mit_t *mit) {
   return mit->ctx;
 }
 
-/*****************
- * grep iterator *
- ****************/
+/*********************
+ * grep/map iterator *
+ ********************/
 
-struct _mit_grep_ctx_t {
-  mit_t *mit;
+/* grep and map iterators share a single implementation holding a list of
+ * stages; stacking them on top of each other fuses the stages into one
+ * iterator so each value passes through all of them in a single call */
+
+/* exactly one of the stage functions is set */
+struct _mit_stage_t {
+  mit_grep_fn_t grepfn;
+  mit_map_fn_t mapfn;
+  mit_grep_sized_fn_t grepsizedfn;
+  mit_map_sized_fn_t mapsizedfn;
+  mit_grep_batch_fn_t grepbatchfn;
   void *ctx;
   mit_free_fn_t freefn;
-  mit_grep_fn_t grepfn;
+  int pure;           /* map without side effects, may be skipped */
+#ifdef MIT_STATS
+  unsigned long long in;
+  unsigned long long out;
+  unsigned long long cycles;
+#endif
+};
+
+#ifdef MIT_STATS
+#define _MIT_STAGE_STAT(stage, field, n) ((stage)->field += (n))
+#else
+#define _MIT_STAGE_STAT(stage, field, n) ((void)0)
+#endif
+
+#define _MIT_STAGE_IS_GREP(stage) \
+  ((stage)->grepfn || (stage)->grepsizedfn || (stage)->grepbatchfn)
+
+/* batches pulled through sized stages need lengths even if the caller does
+ * not want them; batch predicates select values in chunks of this size */
+#define _MIT_PIPE_BATCH 64
+
+struct _mit_pipe_ctx_t {
+  mit_t *mit;
+  int sized;          /* some stage takes lengths */
+  size_t nstages;
+  struct _mit_stage_t stages[];
 };
 
-static void _mit_grep_free(struct _mit_grep_ctx_t *ctx) {
-  if (ctx) {
-    if (ctx->freefn) {
-      ctx->freefn(ctx->ctx);
+static void _mit_pipe_free(struct _mit_pipe_ctx_t *ctx) {
+  size_t i = ctx->nstages;
+  while (i--) {
+    if (ctx->stages[i].freefn) {
+      ctx->stages[i].freefn(ctx->stages[i].ctx);
     }
-    mit_free(ctx->mit);
-    free(ctx);
   }
+  mit_free(ctx->mit);
 }
 
-static mit_status_t _mit_grep_next(void *ctx, void **result) {
-  struct _mit_grep_ctx_t *gctx = ctx;
-  mit_result_t *res;
-  while ((res = mit_next(gctx->mit))->status == MIT_OK) {
+/* returns 1 if the value passed every stage, 0 if it was filtered out and
+ * -1 on error */
+static int _mit_pipe_apply(struct _mit_pipe_ctx_t *pctx,
+    void **value, size_t *len) {
+  struct _mit_stage_t *stage = pctx->stages, *end = stage + pctx->nstages;
+  for (; stage < end; ++stage) {
+    mit_status_t status;
     int matches = 0;
-    switch (gctx->grepfn(res->value, gctx->ctx, &matches)) {
-      case MIT_OK:
-        if (matches) {
-          *result = res->value;
-          return MIT_OK;
+    _MIT_STAGE_STAT(stage, in, 1);
+    {
+      _MIT_CYCLES_BEGIN();
+      if (stage->grepfn) {
+        status = stage->grepfn(*value, stage->ctx, &matches);
+      } else if (stage->mapfn) {
+        matches = 1;
+        status = stage->mapfn(*value, stage->ctx, value);
+        *len = 0; /* the new value's length is unknown */
+      } else if (stage->grepsizedfn) {
+        status = stage->grepsizedfn(*value, *len, stage->ctx, &matches);
+      } else if (stage->grepbatchfn) {
+        unsigned char selected = 0;
+        status = stage->grepbatchfn(value, 1, stage->ctx, &selected);
+        matches = selected;
+      } else {
+        matches = 1;
+        status = stage->mapsizedfn(*value, *len, stage->ctx, value, len);
+      }
+      _MIT_CYCLES_END(stage->cycles);
+    }
+    if (status != MIT_OK) { return -1; }
+    if (!matches) { return 0; }
+    _MIT_STAGE_STAT(stage, out, 1);
+  }
+  return 1;
+}
+
+/* apply one stage to a whole batch, compacting the values that pass; on error
+ * the values before the failing one are kept */
+static mit_status_t _mit_stage_apply_batch(struct _mit_stage_t *stage,
+    void **values, size_t *lens, size_t *n) {
+  mit_status_t status = MIT_OK;
+  size_t i = 0, kept = 0, count = *n;
+
+  if (stage->mapfn) {
+    for (; i < count; ++i) {
+      if ((status = stage->mapfn(values[i], stage->ctx, &values[i])) != MIT_OK) {
+        break;
+      }
+      if (lens) { lens[i] = 0; }
+    }
+    kept = i;
+  } else if (stage->mapsizedfn) {
+    for (; i < count; ++i) {
+      if ((status = stage->mapsizedfn(values[i], lens[i], stage->ctx,
+                      &values[i], &lens[i])) != MIT_OK) {
+        break;
+      }
+    }
+    kept = i;
+  } else if (stage->grepbatchfn) {
+    unsigned char selected[_MIT_PIPE_BATCH];
+    while (i < count) {
+      size_t chunk = count - i < _MIT_PIPE_BATCH ? count - i : _MIT_PIPE_BATCH;
+      size_t j;
+      status = stage->grepbatchfn(values + i, chunk, stage->ctx, selected);
+      if (status != MIT_OK) { break; }
+      for (j = 0; j < chunk; ++j, ++i) {
+        if (selected[j]) {
+          if (lens) { lens[kept] = lens[i]; }
+          values[kept++] = values[i];
         }
+      }
+    }
+  } else {
+    for (; i < count; ++i) {
+      int matches = 0;
+      status = stage->grepfn
+          ? stage->grepfn(values[i], stage->ctx, &matches)
+          : stage->grepsizedfn(values[i], lens[i], stage->ctx, &matches);
+      if (status != MIT_OK) { break; }
+      if (matches) {
+        if (lens) { lens[kept] = lens[i]; }
+        values[kept++] = values[i];
+      }
+    }
+  }
+
+  _MIT_STAGE_STAT(stage, in, i + (status != MIT_OK));
+  _MIT_STAGE_STAT(stage, out, kept);
+  *n = kept;
+  return status;
+}
+
+static mit_status_t _mit_pipe_next(void *ctx, void **result, size_t *len) {
+  struct _mit_pipe_ctx_t *pctx = ctx;
+  mit_result_t *res;
+  while ((res = mit_next(pctx->mit))->status == MIT_OK) {
+    void *value = res->value;
+    size_t vlen = res->len;
+    switch (_mit_pipe_apply(pctx, &value, &vlen)) {
+      case 1:
+        *result = value;
+        *len = vlen;
+        return MIT_OK;
+      case 0:
         break;
       default:
         return MIT_ERROR;
@@ -170,134 +845,3493 @@ static mit_status_t _mit_grep_next(void *ctx, void **result) {
   return res->status;
 }
 
-mit_t *mit_grep(mit_t *mit, mit_grep_fn_t grepfn,
-    void *ctx, mit_free_fn_t freefn) {
-  struct _mit_grep_ctx_t *gctx;
-  mit_t *new;
+static mit_status_t _mit_pipe_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_pipe_ctx_t *pctx = ctx;
+  size_t local[_MIT_PIPE_BATCH], i, kept = 0;
+  int error = 0;
+  if (lens == NULL && pctx->sized) {
+    lens = local;
+    if (n > _MIT_PIPE_BATCH) { n = _MIT_PIPE_BATCH; }
+  }
+  /* stages are applied one at a time across the batch so each runs in a
+   * tight loop */
+  do {
+    kept = mit_next_batch_sized(pctx->mit, values, lens, n);
+    for (i = 0; i < pctx->nstages && kept > 0; ++i) {
+      mit_status_t status;
+      struct _mit_stage_t *stage = &pctx->stages[i];
+      {
+        _MIT_CYCLES_BEGIN();
+        status = _mit_stage_apply_batch(stage, values, lens, &kept);
+        _MIT_CYCLES_END(stage->cycles);
+      }
+      if (status != MIT_OK) {
+        error = 1;
+      }
+    }
+  } while (kept == 0 && !error && mit_is_ready(pctx->mit));
+  *count = kept;
+  return error ? MIT_ERROR : mit_status(pctx->mit);
+}
 
-  if (!(gctx = calloc(1, sizeof(struct _mit_grep_ctx_t)))) { return NULL; }
-  if (!(new = mit_new(_mit_grep_next, gctx, (mit_free_fn_t) _mit_grep_free))) {
-    _mit_grep_free(gctx);
-    return NULL;
+/* values can only be skipped or counted without running the stages if
+ * every stage is a map; skipping also requires them to be pure */
+static mit_status_t _mit_pipe_skip(void *ctx, size_t n, size_t *skipped) {
+  struct _mit_pipe_ctx_t *pctx = ctx;
+  mit_status_t status = MIT_OK;
+  size_t i;
+  for (i = 0; i < pctx->nstages; i++) {
+    if (!pctx->stages[i].pure) { break; }
+  }
+  if (i == pctx->nstages) {
+    return _mit_skip(pctx->mit, n, skipped);
   }
+  for (*skipped = 0; *skipped < n; ++*skipped) {
+    void *value;
+    size_t len;
+    if ((status = _mit_pipe_next(ctx, &value, &len)) != MIT_OK) { break; }
+  }
+  return status;
+}
 
-  gctx->mit = mit;
-  gctx->ctx = ctx;
-  gctx->grepfn = grepfn;
-  gctx->freefn = freefn;
+static int _mit_pipe_size(void *ctx, size_t *remaining) {
+  struct _mit_pipe_ctx_t *pctx = ctx;
+  size_t i;
+  for (i = 0; i < pctx->nstages; i++) {
+    if (_MIT_STAGE_IS_GREP(&pctx->stages[i])) { return 0; }
+  }
+  return mit_size_hint(pctx->mit, remaining);
+}
 
-  new->finite = mit->finite;
+static int _mit_pipe_fd(void *ctx) {
+  struct _mit_pipe_ctx_t *pctx = ctx;
+  return mit_pending_fd(pctx->mit);
+}
 
-  return new;
+/* the wrapped iterator belongs to the new one, so a grep/map iterator can
+ * be absorbed as long as nothing has been pulled into its peek cache */
+static int _mit_pipe_is_fusable(mit_t *mit) {
+  return mit->kind == _MIT_KIND_PIPE
+      && !mit->next_set && mit_is_ready(mit);
 }
 
-/****************
- * map iterator *
- ***************/
+static mit_t *_mit_pipe_push(mit_t *mit, struct _mit_stage_t *stage) {
+  struct _mit_pipe_ctx_t *pctx, *inner = NULL;
+  size_t nstages = 1;
+  mit_t *new;
 
-struct _mit_map_ctx_t {
-  mit_t *mit;
-  void *ctx;
-  mit_free_fn_t freefn;
-  mit_map_fn_t mapfn;
-};
+  if (_mit_pipe_is_fusable(mit)) {
+    inner = mit->ctx;
+    nstages += inner->nstages;
+  }
 
-static void _mit_map_free(struct _mit_map_ctx_t *ctx) {
-  if (ctx) {
-    if (ctx->freefn) {
-      ctx->freefn(ctx->ctx);
-    }
-    mit_free(ctx->mit);
-    free(ctx);
+  if (!(new = _mit_node_new(mit->arena, sizeof(struct _mit_pipe_ctx_t)
+              + nstages * sizeof(struct _mit_stage_t)))) {
+    return NULL;
   }
-}
+  pctx = new->ctx;
+  new->kind = _MIT_KIND_PIPE;
+  new->nextsizedfn = _mit_pipe_next;
+  new->batchsizedfn = _mit_pipe_next_batch;
+  new->skipfn = _mit_pipe_skip;
+  new->sizefn = _mit_pipe_size;
+  new->fdfn = _mit_pipe_fd;
+  new->freefn = (mit_free_fn_t) _mit_pipe_free;
+  new->finite = mit->finite;
+  /* maps without a length drop the lengths of sized values */
+  new->sized = mit->sized && stage->mapfn == NULL;
 
-static mit_status_t _mit_map_next(void *ctx, void **result) {
-  struct _mit_map_ctx_t *mctx = ctx;
-  mit_result_t *res;
-  switch ((res = mit_next(mctx->mit))->status) {
-    case MIT_OK:
-      return mctx->mapfn(res->value, mctx->ctx, result) == MIT_OK
-          ? MIT_OK : MIT_ERROR;
-    default:
-      return mit_status(mctx->mit);
+  if (inner) {
+    memcpy(pctx->stages, inner->stages,
+        inner->nstages * sizeof(struct _mit_stage_t));
+    pctx->mit = inner->mit;
+    pctx->sized = inner->sized;
+    /* the stages and source now belong to the new iterator */
+    mit->freefn = NULL;
+    mit_free(mit);
+  } else {
+    pctx->mit = mit;
   }
+  pctx->stages[nstages - 1] = *stage;
+  pctx->nstages = nstages;
+  pctx->sized = pctx->sized || stage->grepsizedfn || stage->mapsizedfn;
+
+  return new;
+}
+
+mit_t *mit_grep(mit_t *mit, mit_grep_fn_t grepfn,
+    void *ctx, mit_free_fn_t freefn) {
+  struct _mit_stage_t stage;
+  memset(&stage, 0, sizeof(stage));
+  stage.grepfn = grepfn;
+  stage.ctx = ctx;
+  stage.freefn = freefn;
+  return _mit_pipe_push(mit, &stage);
 }
 
 mit_t *mit_map(mit_t *mit, mit_map_fn_t mapfn,
     void *ctx, mit_free_fn_t freefn) {
-  struct _mit_map_ctx_t *mctx;
-  mit_t *new;
+  struct _mit_stage_t stage;
+  memset(&stage, 0, sizeof(stage));
+  stage.mapfn = mapfn;
+  stage.ctx = ctx;
+  stage.freefn = freefn;
+  return _mit_pipe_push(mit, &stage);
+}
 
-  if (!(mctx = calloc(1, sizeof(struct _mit_map_ctx_t)))) { return NULL; }
-  if (!(new = mit_new(_mit_map_next, mctx, (mit_free_fn_t) _mit_map_free))) {
-    _mit_map_free(mctx);
-    return NULL;
-  }
+mit_t *mit_grep_sized(mit_t *mit, mit_grep_sized_fn_t grepfn,
+    void *ctx, mit_free_fn_t freefn) {
+  struct _mit_stage_t stage;
+  memset(&stage, 0, sizeof(stage));
+  stage.grepsizedfn = grepfn;
+  stage.ctx = ctx;
+  stage.freefn = freefn;
+  return _mit_pipe_push(mit, &stage);
+}
 
-  mctx->mit = mit;
-  mctx->ctx = ctx;
-  mctx->mapfn = mapfn;
-  mctx->freefn = freefn;
+mit_t *mit_map_sized(mit_t *mit, mit_map_sized_fn_t mapfn,
+    void *ctx, mit_free_fn_t freefn) {
+  struct _mit_stage_t stage;
+  memset(&stage, 0, sizeof(stage));
+  stage.mapsizedfn = mapfn;
+  stage.ctx = ctx;
+  stage.freefn = freefn;
+  return _mit_pipe_push(mit, &stage);
+}
 
-  new->finite = mit->finite;
+mit_t *mit_grep_batch(mit_t *mit, mit_grep_batch_fn_t grepfn,
+    void *ctx, mit_free_fn_t freefn) {
+  struct _mit_stage_t stage;
+  memset(&stage, 0, sizeof(stage));
+  stage.grepbatchfn = grepfn;
+  stage.ctx = ctx;
+  stage.freefn = freefn;
+  return _mit_pipe_push(mit, &stage);
+}
 
-  return new;
+mit_t *mit_map_pure(mit_t *mit, mit_map_fn_t mapfn,
+    void *ctx, mit_free_fn_t freefn) {
+  struct _mit_stage_t stage;
+  memset(&stage, 0, sizeof(stage));
+  stage.mapfn = mapfn;
+  stage.ctx = ctx;
+  stage.freefn = freefn;
+  stage.pure = 1;
+  return _mit_pipe_push(mit, &stage);
 }
 
 /******************
  * chain iterator *
  *****************/
 
+/* chains are kept flat: chaining a chain copies its remaining sources so
+ * every value is retrieved directly from the active source */
+
 struct _mit_chain_ctx_t {
-  mit_t *mit1;
-  mit_t *mit2;
+  size_t pos;         /* active source */
+  size_t n;
+  mit_t *mits[];
 };
 
 static void _mit_chain_free(struct _mit_chain_ctx_t *ctx) {
-  if (ctx) {
-    mit_free(ctx->mit1);
-    mit_free(ctx->mit2);
-    free(ctx);
+  while (ctx->pos < ctx->n) {
+    mit_free(ctx->mits[ctx->pos++]);
   }
 }
 
-static mit_status_t _mit_chain_next(void *ctx, void **result) {
+static mit_status_t _mit_chain_next(void *ctx, void **result, size_t *len) {
   struct _mit_chain_ctx_t *cctx = ctx;
   mit_result_t *res;
-  if (cctx->mit1 == NULL) { return MIT_EXHAUSTED; }
-  switch ((res = mit_next(cctx->mit1))->status) {
-    case MIT_OK:
-      *result = res->value;
+  while (cctx->pos < cctx->n) {
+    switch ((res = mit_next(cctx->mits[cctx->pos]))->status) {
+      case MIT_OK:
+        *result = res->value;
+        *len = res->len;
+        return MIT_OK;
+      case MIT_EXHAUSTED:
+        mit_free(cctx->mits[cctx->pos++]);
+        break;
+      case MIT_PENDING:
+        return MIT_PENDING;
+      default:
+        return MIT_ERROR;
+    }
+  }
+  return MIT_EXHAUSTED;
+}
+
+static mit_status_t _mit_chain_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_chain_ctx_t *cctx = ctx;
+  while (cctx->pos < cctx->n) {
+    mit_t *mit = cctx->mits[cctx->pos];
+    /* values may belong to mit, so it is only released on an empty pull */
+    if ((*count = mit_next_batch_sized(mit, values, lens, n)) > 0) {
       return MIT_OK;
-    case MIT_EXHAUSTED:
-      mit_free(cctx->mit1);
-      cctx->mit1 = cctx->mit2;
-      cctx->mit2 = NULL;
-      return _mit_chain_next(ctx, result);
-    default:
-      return MIT_ERROR;
+    } else if (!mit_is_exhausted(mit)) {
+      return mit_is_pending(mit) ? MIT_PENDING : MIT_ERROR;
+    }
+    mit_free(mit);
+    cctx->pos++;
   }
+  return MIT_EXHAUSTED;
 }
 
-mit_t *mit_chain(mit_t *mit1, mit_t *mit2) {
-  struct _mit_chain_ctx_t *cctx;
-  mit_t *new;
+static mit_status_t _mit_chain_skip(void *ctx, size_t n, size_t *skipped) {
+  struct _mit_chain_ctx_t *cctx = ctx;
+  *skipped = 0;
+  while (cctx->pos < cctx->n) {
+    mit_t *mit = cctx->mits[cctx->pos];
+    size_t count;
+    _mit_skip(mit, n - *skipped, &count);
+    if ((*skipped += count) == n) {
+      return MIT_OK;
+    } else if (!mit_is_exhausted(mit)) {
+      return mit_is_pending(mit) ? MIT_PENDING : MIT_ERROR;
+    }
+    mit_free(mit);
+    cctx->pos++;
+  }
+  return MIT_EXHAUSTED;
+}
+
+static int _mit_chain_size(void *ctx, size_t *remaining) {
+  struct _mit_chain_ctx_t *cctx = ctx;
+  size_t i, total = 0;
+  for (i = cctx->pos; i < cctx->n; i++) {
+    size_t count;
+    if (!mit_size_hint(cctx->mits[i], &count)) { return 0; }
+    total += count;
+  }
+  *remaining = total;
+  return 1;
+}
+
+static int _mit_chain_fd(void *ctx) {
+  struct _mit_chain_ctx_t *cctx = ctx;
+  return cctx->pos < cctx->n ? mit_pending_fd(cctx->mits[cctx->pos]) : -1;
+}
+
+static int _mit_chain_is_flattenable(mit_t *mit) {
+  return mit->kind == _MIT_KIND_CHAIN
+      && !mit->next_set && mit_is_ready(mit);
+}
+
+mit_t *mit_chain_n(mit_t **mits, size_t n) {
+  struct _mit_chain_ctx_t *cctx;
+  size_t i, count = 0;
+  mit_t *new;
+
+  for (i = 0; i < n; i++) {
+    if (_mit_chain_is_flattenable(mits[i])) {
+      struct _mit_chain_ctx_t *inner = mits[i]->ctx;
+      count += inner->n - inner->pos;
+    } else {
+      count++;
+    }
+  }
+
+  if (!(new = _mit_node_new(n ? mits[0]->arena : NULL,
+              sizeof(struct _mit_chain_ctx_t) + count * sizeof(mit_t *)))) {
+    return NULL;
+  }
+  cctx = new->ctx;
+  new->kind = _MIT_KIND_CHAIN;
+  new->nextsizedfn = _mit_chain_next;
+  new->batchsizedfn = _mit_chain_next_batch;
+  new->skipfn = _mit_chain_skip;
+  new->sizefn = _mit_chain_size;
+  new->fdfn = _mit_chain_fd;
+  new->freefn = (mit_free_fn_t) _mit_chain_free;
+  new->finite = 1;
+  new->sized = 1;
+
+  for (i = 0; i < n; i++) {
+    mit_t *mit = mits[i];
+    new->finite = new->finite && mit->finite;
+    new->sized = new->sized && mit->sized;
+    if (_mit_chain_is_flattenable(mit)) {
+      struct _mit_chain_ctx_t *inner = mit->ctx;
+      while (inner->pos < inner->n) {
+        cctx->mits[cctx->n++] = inner->mits[inner->pos++];
+      }
+      mit_free(mit);
+    } else {
+      cctx->mits[cctx->n++] = mit;
+    }
+  }
+
+  return new;
+}
+
+mit_t *mit_chain(mit_t *mit1, mit_t *mit2) {
+  mit_t *mits[2];
+  mits[0] = mit1;
+  mits[1] = mit2;
+  return mit_chain_n(mits, 2);
+}
+
+/******************
+ * take iterators *
+ *****************/
+
+/* mit_take, mit_take_while, and mit_skip_while share a context.  Once the
+ * limit is reached the wrapped iterator is released rather than kept until
+ * mit_free, along with any files, buffers, or threads it holds.  The last
+ * value returned may still point into it, so release normally waits for the
+ * next retrieval, unless the values are known to outlive their iterator.
+ * A prefetch thread running ahead is stopped with the last value all the
+ * same, since nothing it produces from then on is used. */
+
+#ifdef MIT_THREADS
+struct _mit_prefetch_ctx_t;
+static void _mit_prefetch_stop(struct _mit_prefetch_ctx_t *pctx);
+#endif
+
+struct _mit_take_ctx_t {
+  mit_t *mit;         /* NULL once released */
+  size_t remaining;   /* values left for mit_take */
+  mit_grep_fn_t fn;   /* predicate for mit_take_while and mit_skip_while */
+  void *ctx;
+  mit_free_fn_t freefn;
+  int done;           /* no more values will be returned */
+  int skipping;       /* mit_skip_while is still dropping values */
+};
+
+static int _mit_values_outlive(mit_t *mit) {
+  struct _mit_pipe_ctx_t *pctx;
+  size_t i;
+  switch (mit->kind) {
+    case _MIT_KIND_ARRAY:
+    case _MIT_KIND_RANGE:
+      return 1;
+    case _MIT_KIND_PIPE:
+      /* greps return the values of the wrapped iterator unchanged */
+      pctx = mit->ctx;
+      for (i = 0; i < pctx->nstages; i++) {
+        if (!_MIT_STAGE_IS_GREP(&pctx->stages[i])) { return 0; }
+      }
+      return _mit_values_outlive(pctx->mit);
+    default:
+      return 0;
+  }
+}
+
+static void _mit_take_release(struct _mit_take_ctx_t *tctx) {
+  tctx->done = 1;
+  if (tctx->mit) {
+    mit_free(tctx->mit);
+    tctx->mit = NULL;
+  }
+}
+
+/* stop a prefetch thread below any grep or map stages */
+static void _mit_take_stop(mit_t *mit) {
+  while (mit->kind == _MIT_KIND_PIPE) {
+    mit = ((struct _mit_pipe_ctx_t *)mit->ctx)->mit;
+  }
+#ifdef MIT_THREADS
+  if (mit->kind == _MIT_KIND_PREFETCH) { _mit_prefetch_stop(mit->ctx); }
+#endif
+}
+
+/* the last value has been returned */
+static void _mit_take_finish(struct _mit_take_ctx_t *tctx) {
+  tctx->done = 1;
+  if (_mit_values_outlive(tctx->mit)) {
+    _mit_take_release(tctx);
+  } else {
+    _mit_take_stop(tctx->mit);
+  }
+}
+
+/* the wrapped iterator returned no value */
+static mit_status_t _mit_take_end(struct _mit_take_ctx_t *tctx,
+    mit_status_t status) {
+  if (status == MIT_EXHAUSTED) { _mit_take_release(tctx); }
+  return status;
+}
+
+static void _mit_take_free(struct _mit_take_ctx_t *tctx) {
+  _mit_take_release(tctx);
+  if (tctx->freefn) { tctx->freefn(tctx->ctx); }
+}
+
+static mit_status_t _mit_take_next(void *ctx, void **result, size_t *len) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  mit_result_t *res;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  if ((res = mit_next(tctx->mit))->status != MIT_OK) {
+    return _mit_take_end(tctx, res->status);
+  }
+  *result = res->value;
+  *len = res->len;
+  if (--tctx->remaining == 0) { _mit_take_finish(tctx); }
+  return MIT_OK;
+}
+
+static mit_status_t _mit_take_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  *count = 0;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  if (n > tctx->remaining) { n = tctx->remaining; }
+  if ((*count = mit_next_batch_sized(tctx->mit, values, lens, n)) == 0) {
+    return _mit_take_end(tctx, mit_status(tctx->mit));
+  }
+  if ((tctx->remaining -= *count) == 0) { _mit_take_finish(tctx); }
+  return MIT_OK;
+}
+
+static mit_status_t _mit_take_skip(void *ctx, size_t n, size_t *skipped) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  mit_status_t status;
+  *skipped = 0;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  status = _mit_skip(tctx->mit, n < tctx->remaining ? n : tctx->remaining,
+          skipped);
+  tctx->remaining -= *skipped;
+  if (status != MIT_OK) { return _mit_take_end(tctx, status); }
+  if (tctx->remaining == 0) {
+    /* skipped values are not handed out */
+    _mit_take_release(tctx);
+    return *skipped == n ? MIT_OK : MIT_EXHAUSTED;
+  }
+  return MIT_OK;
+}
+
+static int _mit_take_size(void *ctx, size_t *remaining) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  size_t inner;
+  if (tctx->done) {
+    *remaining = 0;
+    return 1;
+  }
+  if (!mit_size_hint(tctx->mit, &inner)) { return 0; }
+  *remaining = inner < tctx->remaining ? inner : tctx->remaining;
+  return 1;
+}
+
+static int _mit_take_fd(void *ctx) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  return tctx->mit ? mit_pending_fd(tctx->mit) : -1;
+}
+
+static mit_status_t _mit_take_while_next(void *ctx,
+    void **result, size_t *len) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  mit_result_t *res;
+  int matches = 0;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  if ((res = mit_next(tctx->mit))->status != MIT_OK) {
+    return _mit_take_end(tctx, res->status);
+  }
+  if (tctx->fn(res->value, tctx->ctx, &matches) != MIT_OK) {
+    return MIT_ERROR;
+  }
+  if (!matches) {
+    /* the rejected value is not handed out, nothing can refer to it */
+    return _mit_take_end(tctx, MIT_EXHAUSTED);
+  }
+  *result = res->value;
+  *len = res->len;
+  return MIT_OK;
+}
+
+static mit_status_t _mit_take_while_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  size_t i;
+  *count = 0;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  if ((*count = mit_next_batch_sized(tctx->mit, values, lens, n)) == 0) {
+    return _mit_take_end(tctx, mit_status(tctx->mit));
+  }
+  for (i = 0; i < *count; i++) {
+    int matches = 0;
+    if (tctx->fn(values[i], tctx->ctx, &matches) != MIT_OK) {
+      *count = i;
+      return MIT_ERROR;
+    }
+    if (!matches) {
+      if ((*count = i) == 0) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+      _mit_take_finish(tctx);
+      break;
+    }
+  }
+  return MIT_OK;
+}
+
+static mit_status_t _mit_skip_while_next(void *ctx,
+    void **result, size_t *len) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  mit_result_t *res;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  while ((res = mit_next(tctx->mit))->status == MIT_OK) {
+    if (tctx->skipping) {
+      int matches = 0;
+      if (tctx->fn(res->value, tctx->ctx, &matches) != MIT_OK) {
+        return MIT_ERROR;
+      }
+      if (matches) { continue; }
+      tctx->skipping = 0;
+    }
+    *result = res->value;
+    *len = res->len;
+    return MIT_OK;
+  }
+  return _mit_take_end(tctx, res->status);
+}
+
+static mit_status_t _mit_skip_while_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_take_ctx_t *tctx = ctx;
+  *count = 0;
+  if (tctx->done) { return _mit_take_end(tctx, MIT_EXHAUSTED); }
+  do {
+    size_t i;
+    if ((*count = mit_next_batch_sized(tctx->mit, values, lens, n)) == 0) {
+      return _mit_take_end(tctx, mit_status(tctx->mit));
+    }
+    if (!tctx->skipping) { break; }
+    for (i = 0; i < *count; i++) {
+      int matches = 0;
+      if (tctx->fn(values[i], tctx->ctx, &matches) != MIT_OK) {
+        *count = 0;
+        return MIT_ERROR;
+      }
+      if (!matches) { break; }
+    }
+    if (i < *count) {
+      tctx->skipping = 0;
+      memmove(values, values + i, (*count - i) * sizeof(void *));
+      if (lens) { memmove(lens, lens + i, (*count - i) * sizeof(size_t)); }
+    }
+    *count -= i;
+  } while (*count == 0);
+  return MIT_OK;
+}
+
+static mit_t *_mit_take_new(mit_t *mit,
+    mit_next_sized_fn_t nextfn, mit_batch_sized_fn_t batchfn) {
+  mit_t *new = _mit_node_new(mit->arena, sizeof(struct _mit_take_ctx_t));
+  struct _mit_take_ctx_t *tctx;
+  if (new == NULL) { return NULL; }
+  tctx = new->ctx;
+  tctx->mit = mit;
+  new->kind = _MIT_KIND_TAKE;
+  new->nextsizedfn = nextfn;
+  new->batchsizedfn = batchfn;
+  new->fdfn = _mit_take_fd;
+  new->freefn = (mit_free_fn_t) _mit_take_free;
+  new->finite = mit->finite;
+  new->sized = mit->sized;
+  return new;
+}
+
+mit_t *mit_take(mit_t *mit, size_t n) {
+  mit_t *new = _mit_take_new(mit, _mit_take_next, _mit_take_next_batch);
+  struct _mit_take_ctx_t *tctx;
+  if (new == NULL) { return NULL; }
+  tctx = new->ctx;
+  tctx->remaining = n;
+  new->skipfn = _mit_take_skip;
+  new->sizefn = _mit_take_size;
+  new->finite = 1;
+  if (n == 0) { _mit_take_release(tctx); }
+  return new;
+}
+
+mit_t *mit_take_while(mit_t *mit, mit_grep_fn_t fn,
+    void *ctx, mit_free_fn_t freefn) {
+  mit_t *new = _mit_take_new(mit,
+          _mit_take_while_next, _mit_take_while_next_batch);
+  struct _mit_take_ctx_t *tctx;
+  if (new == NULL) { return NULL; }
+  tctx = new->ctx;
+  tctx->fn = fn;
+  tctx->ctx = ctx;
+  tctx->freefn = freefn;
+  return new;
+}
+
+mit_t *mit_skip_while(mit_t *mit, mit_grep_fn_t fn,
+    void *ctx, mit_free_fn_t freefn) {
+  mit_t *new = _mit_take_new(mit,
+          _mit_skip_while_next, _mit_skip_while_next_batch);
+  struct _mit_take_ctx_t *tctx;
+  if (new == NULL) { return NULL; }
+  tctx = new->ctx;
+  tctx->fn = fn;
+  tctx->ctx = ctx;
+  tctx->freefn = freefn;
+  tctx->skipping = 1;
+  return new;
+}
+
+/********************
+ * window iterators *
+ *******************/
+
+/* mit_chunk and mit_window return views into a ring of values kept in the
+ * iterator itself.  When windows overlap the ring has room to read ahead a
+ * batch beyond the window, and its start is mirrored past its end, so the
+ * window starting at any position is contiguous and nothing is moved as it
+ * slides.  Over sized input a second ring laid out the same way follows the
+ * first and holds the lengths. */
+
+struct _mit_window_ctx_t {
+  mit_t *mit;
+  size_t size;        /* values per window */
+  size_t step;        /* values between the starts of windows */
+  size_t cap;         /* values the ring holds */
+  size_t start;       /* ring position of the first value */
+  size_t count;       /* values in the ring */
+  size_t gap;         /* values to skip before the next window */
+  int partial;        /* return a last window that is not full */
+  int returned;       /* the ring holds the window returned last */
+  size_t *lens;       /* lengths of sized values, or NULL */
+  void *ring[];
+};
+
+static mit_status_t _mit_window_next(void *ctx, void **result, size_t *len) {
+  struct _mit_window_ctx_t *w = ctx;
+
+  if (w->returned) {
+    if (w->step >= w->count) {
+      w->gap += w->step - w->count;
+      w->start = w->count = 0;
+    } else {
+      w->start = (w->start + w->step) % w->cap;
+      w->count -= w->step;
+    }
+    w->returned = 0;
+  }
+  if (w->gap) {
+    size_t skipped = 0;
+    mit_status_t status = _mit_skip(w->mit, w->gap, &skipped);
+    w->gap -= skipped;
+    if (status != MIT_OK) { return status; }
+  }
+  while (w->count < w->size) {
+    size_t pos = (w->start + w->count) % w->cap, got;
+    size_t want = w->cap - w->count;
+    /* fill up to the end of the ring, then wrap around */
+    if (want > w->cap - pos) { want = w->cap - pos; }
+    got = mit_next_batch_sized(w->mit, w->ring + pos,
+        w->lens ? w->lens + pos : NULL, want);
+    if (got == 0) {
+      mit_status_t status = mit_status(w->mit);
+      if (status != MIT_EXHAUSTED) { return status; }
+      if (!w->partial || w->count == 0) { return MIT_EXHAUSTED; }
+      break;
+    }
+    if (w->cap > w->size && pos < w->size - 1) {
+      size_t n = w->size - 1 - pos < got ? w->size - 1 - pos : got;
+      memcpy(w->ring + w->cap + pos, w->ring + pos, n * sizeof(void *));
+      if (w->lens) {
+        memcpy(w->lens + w->cap + pos, w->lens + pos, n * sizeof(size_t));
+      }
+    }
+    w->count += got;
+  }
+  w->returned = 1;
+  *result = w->ring + w->start;
+  *len = (w->count < w->size ? w->count : w->size) * sizeof(void *);
+  return MIT_OK;
+}
+
+static int _mit_chunk_size(void *ctx, size_t *remaining) {
+  struct _mit_window_ctx_t *w = ctx;
+  size_t inner;
+  if (!mit_size_hint(w->mit, &inner)) { return 0; }
+  inner += w->returned ? 0 : w->count;
+  *remaining = (inner + w->size - 1) / w->size;
+  return 1;
+}
+
+static int _mit_window_fd(void *ctx) {
+  struct _mit_window_ctx_t *w = ctx;
+  return mit_pending_fd(w->mit);
+}
+
+static void _mit_window_free(struct _mit_window_ctx_t *w) {
+  mit_free(w->mit);
+}
+
+static mit_t *_mit_window_new(mit_t *mit, size_t size, size_t step,
+    int partial) {
+  /* windows that do not overlap are filled exactly, leaving the values in
+   * between to be skipped */
+  size_t cap = step < size ? size + _MIT_PIPE_BATCH : size;
+  size_t slots = cap + (cap > size ? size - 1 : 0);
+  struct _mit_window_ctx_t *w;
+  mit_t *new;
+  if (size == 0 || step == 0) { return NULL; }
+  if (!(new = _mit_node_new(mit->arena, sizeof(struct _mit_window_ctx_t)
+                  + slots * (sizeof(void *)
+                      + (mit->sized ? sizeof(size_t) : 0))))) {
+    return NULL;
+  }
+  w = new->ctx;
+  w->mit = mit;
+  w->lens = mit->sized ? (size_t *)(w->ring + slots) : NULL;
+  w->size = size;
+  w->step = step;
+  w->cap = cap;
+  w->partial = partial;
+  new->kind = _MIT_KIND_WINDOW;
+  new->nextsizedfn = _mit_window_next;
+  new->fdfn = _mit_window_fd;
+  new->freefn = (mit_free_fn_t) _mit_window_free;
+  new->finite = mit->finite;
+  new->sized = 1;
+  return new;
+}
+
+mit_t *mit_chunk(mit_t *mit, size_t n) {
+  mit_t *new = _mit_window_new(mit, n, n, 1);
+  if (new) { new->sizefn = _mit_chunk_size; }
+  return new;
+}
+
+mit_t *mit_window(mit_t *mit, size_t size, size_t step) {
+  return _mit_window_new(mit, size, step, 0);
+}
+
+size_t *mit_window_lens(mit_t *mit) {
+  struct _mit_window_ctx_t *w = mit->ctx;
+  if (mit->kind != _MIT_KIND_WINDOW || !w->returned) { return NULL; }
+  return w->lens ? w->lens + w->start : NULL;
+}
+
+/******************
+ * merge iterator *
+ *****************/
+
+/* the heads of the inputs are the leaves of a loser tree: every internal
+ * node holds the input that lost the match played there and tree[0] the
+ * overall winner.  After the winner is returned only the matches on the path
+ * from its leaf to the root are replayed, so each value costs log2(k)
+ * comparisons against values already known to be close to it. */
+
+struct _mit_merge_ctx_t {
+  mit_cmp_fn_t cmp;
+  void *ctx;
+  int stable;         /* equal values are returned in input order */
+  int primed;         /* every input has a head and the tree is built */
+  size_t k;
+  size_t refill;      /* input whose head must be retrieved, or k */
+  size_t *tree;
+  mit_result_t **heads; /* NULL once an input is exhausted */
+  mit_t **mits;
+};
+
+/* does input a win against input b */
+static int _mit_merge_beats(struct _mit_merge_ctx_t *m, size_t a, size_t b) {
+  int c;
+  if (m->heads[a] == NULL) { return 0; }
+  if (m->heads[b] == NULL) { return 1; }
+  c = m->cmp(m->heads[a], m->heads[b], m->ctx);
+  return c < 0 || (c == 0 && m->stable && a < b);
+}
+
+/* leaves are nodes k to 2k - 1 of a tree rooted at node 1 */
+static size_t _mit_merge_build(struct _mit_merge_ctx_t *m, size_t node) {
+  size_t l, r;
+  if (node >= m->k) { return node - m->k; }
+  l = _mit_merge_build(m, 2 * node);
+  r = _mit_merge_build(m, 2 * node + 1);
+  if (_mit_merge_beats(m, l, r)) {
+    m->tree[node] = r;
+    return l;
+  }
+  m->tree[node] = l;
+  return r;
+}
+
+static void _mit_merge_replay(struct _mit_merge_ctx_t *m, size_t i) {
+  size_t winner = i, node;
+  for (node = (i + m->k) / 2; node > 0; node /= 2) {
+    if (_mit_merge_beats(m, m->tree[node], winner)) {
+      size_t loser = winner;
+      winner = m->tree[node];
+      m->tree[node] = loser;
+    }
+  }
+  m->tree[0] = winner;
+}
+
+/* retrieve the head of input i; exhausted inputs are released */
+static mit_status_t _mit_merge_head(struct _mit_merge_ctx_t *m, size_t i) {
+  mit_result_t *res = mit_peek(m->mits[i]);
+  switch (res->status) {
+    case MIT_OK:
+      m->heads[i] = res;
+      return MIT_OK;
+    case MIT_EXHAUSTED:
+      mit_free(m->mits[i]);
+      m->mits[i] = NULL;
+      m->heads[i] = NULL;
+      return MIT_OK;
+    default:
+      m->refill = i;
+      return res->status;
+  }
+}
+
+static mit_status_t _mit_merge_next(void *ctx, void **result, size_t *len) {
+  struct _mit_merge_ctx_t *m = ctx;
+  mit_status_t status;
+  size_t w;
+
+  if (!m->primed) {
+    for (; m->refill < m->k; m->refill++) {
+      if ((status = _mit_merge_head(m, m->refill)) != MIT_OK) {
+        return status;
+      }
+    }
+    if (m->k == 0) { return MIT_EXHAUSTED; }
+    m->tree[0] = m->k > 1 ? _mit_merge_build(m, 1) : 0;
+    m->primed = 1;
+  } else if (m->refill < m->k) {
+    if ((status = _mit_merge_head(m, m->refill)) != MIT_OK) { return status; }
+    _mit_merge_replay(m, m->refill);
+  }
+
+  w = m->tree[0];
+  m->refill = m->k;
+  if (m->heads[w] == NULL) { return MIT_EXHAUSTED; }
+  *result = m->heads[w]->value;
+  *len = m->heads[w]->len;
+  /* consuming the cached head leaves the value intact until the input is
+   * asked for another one */
+  mit_next(m->mits[w]);
+  m->refill = w;
+  return MIT_OK;
+}
+
+static int _mit_merge_size(void *ctx, size_t *remaining) {
+  struct _mit_merge_ctx_t *m = ctx;
+  size_t i, total = 0;
+  for (i = 0; i < m->k; i++) {
+    size_t count;
+    if (m->mits[i] == NULL) { continue; }
+    if (!mit_size_hint(m->mits[i], &count)) { return 0; }
+    total += count;
+  }
+  *remaining = total;
+  return 1;
+}
+
+static int _mit_merge_fd(void *ctx) {
+  struct _mit_merge_ctx_t *m = ctx;
+  return m->refill < m->k && m->mits[m->refill]
+      ? mit_pending_fd(m->mits[m->refill]) : -1;
+}
+
+static void _mit_merge_free(struct _mit_merge_ctx_t *m) {
+  size_t i;
+  for (i = 0; i < m->k; i++) { mit_free(m->mits[i]); }
+}
+
+mit_t *mit_merge_sorted(mit_t **mits, size_t k,
+    mit_cmp_fn_t cmp, void *ctx, int stable) {
+  struct _mit_merge_ctx_t *m;
+  size_t msize, tsize, hsize, i;
+  unsigned char *mem;
+  mit_t *new;
+
+  msize = _MIT_ROUND_UP(sizeof(struct _mit_merge_ctx_t), _MIT_ALIGNMENT);
+  tsize = _MIT_ROUND_UP(k * sizeof(size_t), _MIT_ALIGNMENT);
+  hsize = k * sizeof(mit_result_t *);
+  if (!(new = _mit_node_new(k ? mits[0]->arena : NULL,
+              msize + tsize + hsize + k * sizeof(mit_t *)))) {
+    return NULL;
+  }
+  m = new->ctx;
+  mem = new->ctx;
+  m->tree = (size_t *)(mem + msize);
+  m->heads = (mit_result_t **)(mem + msize + tsize);
+  m->mits = (mit_t **)(mem + msize + tsize + hsize);
+  m->cmp = cmp;
+  m->ctx = ctx;
+  m->stable = stable;
+  m->k = k;
+  new->finite = 1;
+  new->sized = 1;
+  for (i = 0; i < k; i++) {
+    m->mits[i] = mits[i];
+    new->finite = new->finite && mits[i]->finite;
+    new->sized = new->sized && mits[i]->sized;
+  }
+
+  new->kind = _MIT_KIND_MERGE;
+  new->nextsizedfn = _mit_merge_next;
+  new->sizefn = _mit_merge_size;
+  new->fdfn = _mit_merge_fd;
+  new->freefn = (mit_free_fn_t) _mit_merge_free;
+  return new;
+}
+
+/*****************
+ * sort iterator *
+ ****************/
+
+/* values are collected into a buffer until it reaches the memory limit,
+ * then sorted with a merge sort and appended to a temporary file as a run.
+ * If the whole input fits it is returned straight from the buffer;
+ * otherwise the last buffer is spilled as well and the runs are read back in
+ * blocks and combined with mit_merge_sorted.  Values with a length are
+ * copied, others are stored as they are.  The file is unlinked as soon as it
+ * is created, so nothing is left behind however the iterator ends. */
+
+#define _MIT_SORT_MEMORY ((size_t)64 << 20)
+#define _MIT_SORT_BLOCK_MIN ((size_t)4 << 10)
+#define _MIT_SORT_BLOCK_MAX ((size_t)1 << 20)
+#define _MIT_SORT_INSERTION 16
+
+/* memory used by each buffered value, including the merge sort scratch */
+#define _MIT_SORT_ENTRY (sizeof(mit_result_t) + sizeof(mit_result_t) / 2)
+
+struct _mit_sort_ctx_t {
+  mit_t *mit;         /* input, NULL once drained */
+  mit_t *out;         /* merge of the runs */
+  mit_cmp_fn_t cmp;
+  void *ctx;
+  size_t limit;
+  const char *tmpdir;
+  int sized;          /* copy every value, even empty ones */
+
+  mit_result_t *entries;
+  mit_result_t *scratch;
+  size_t n, cap, pos;
+  unsigned char *bytes; /* copies of sized values */
+  size_t nbytes, bytescap;
+  size_t used;
+
+  FILE *spill;
+  long *runs;         /* end offset of each run */
+  size_t nruns, runscap;
+};
+
+static void _mit_sort_insertion(mit_result_t *a, size_t n,
+    mit_cmp_fn_t cmp, void *ctx) {
+  size_t i, j;
+  for (i = 1; i < n; i++) {
+    mit_result_t key = a[i];
+    for (j = i; j > 0 && cmp(&a[j - 1], &key, ctx) > 0; j--) {
+      a[j] = a[j - 1];
+    }
+    a[j] = key;
+  }
+}
+
+/* stable merge sort; tmp holds at least half of n */
+static void _mit_sort_merge(mit_result_t *a, mit_result_t *tmp, size_t n,
+    mit_cmp_fn_t cmp, void *ctx) {
+  size_t mid = n / 2, i = 0, j = mid, k = 0;
+  if (n <= _MIT_SORT_INSERTION) {
+    _mit_sort_insertion(a, n, cmp, ctx);
+    return;
+  }
+  _mit_sort_merge(a, tmp, mid, cmp, ctx);
+  _mit_sort_merge(a + mid, tmp, n - mid, cmp, ctx);
+  if (cmp(&a[mid - 1], &a[mid], ctx) <= 0) { return; }
+  memcpy(tmp, a, mid * sizeof(mit_result_t));
+  while (i < mid && j < n) {
+    a[k++] = cmp(&a[j], &tmp[i], ctx) < 0 ? a[j++] : tmp[i++];
+  }
+  while (i < mid) { a[k++] = tmp[i++]; }
+}
+
+/* sort the buffered values, turning offsets of copied values into pointers */
+static int _mit_sort_buffer(struct _mit_sort_ctx_t *s) {
+  mit_result_t *scratch;
+  size_t i;
+  for (i = 0; i < s->n; i++) {
+    if (s->sized || s->entries[i].len) {
+      s->entries[i].value = s->bytes + (uintptr_t)s->entries[i].value;
+    }
+  }
+  scratch = _mit_realloc(s->scratch, (s->n / 2 + 1) * sizeof(mit_result_t));
+  if (scratch == NULL) { return -1; }
+  s->scratch = scratch;
+  _mit_sort_merge(s->entries, s->scratch, s->n, s->cmp, s->ctx);
+  return 0;
+}
+
+static FILE *_mit_sort_tmpfile(const char *tmpdir) {
+#ifdef MIT_POSIX
+  if (tmpdir) {
+    static const char name[] = "/mit-sort-XXXXXX";
+    size_t len = strlen(tmpdir);
+    char *path = _mit_malloc(len + sizeof(name));
+    FILE *f = NULL;
+    int fd;
+    if (path == NULL) { return NULL; }
+    memcpy(path, tmpdir, len);
+    memcpy(path + len, name, sizeof(name));
+    if ((fd = mkstemp(path)) >= 0) {
+      unlink(path);
+      if ((f = fdopen(fd, "w+b")) == NULL) { close(fd); }
+    }
+    _mit_dealloc(path);
+    return f;
+  }
+#else
+  (void)tmpdir;
+#endif
+  return tmpfile();
+}
+
+/* values of sized iterators are written as the length and the bytes, others
+ * as a zero length and the pointer itself */
+static int _mit_record_write(FILE *f, void *value, size_t len, int sized) {
+  if (fwrite(&len, sizeof(len), 1, f) != 1) { return -1; }
+  if (len == 0 && !sized) {
+    return fwrite(&value, sizeof(value), 1, f) == 1 ? 0 : -1;
+  }
+  return len == 0 || fwrite(value, len, 1, f) == 1 ? 0 : -1;
+}
+
+/* append the buffer to the spill file as a sorted run */
+static int _mit_sort_spill(struct _mit_sort_ctx_t *s) {
+  size_t i;
+  if (s->spill == NULL && (s->spill = _mit_sort_tmpfile(s->tmpdir)) == NULL) {
+    return -1;
+  }
+  if (s->nruns == s->runscap) {
+    size_t cap = s->runscap ? s->runscap * 2 : 16;
+    long *runs = _mit_realloc(s->runs, cap * sizeof(long));
+    if (runs == NULL) { return -1; }
+    s->runs = runs;
+    s->runscap = cap;
+  }
+  if (_mit_sort_buffer(s) != 0) { return -1; }
+  for (i = 0; i < s->n; i++) {
+    mit_result_t *e = &s->entries[i];
+    if (_mit_record_write(s->spill, e->value, e->len, s->sized) != 0) {
+      return -1;
+    }
+  }
+  if ((s->runs[s->nruns] = ftell(s->spill)) < 0) { return -1; }
+  s->nruns++;
+  s->n = s->nbytes = s->used = 0;
+  return 0;
+}
+
+static int _mit_sort_add(struct _mit_sort_ctx_t *s, mit_result_t *res) {
+  size_t cost = _MIT_SORT_ENTRY + res->len;
+  mit_result_t *e;
+  if (s->n > 0 && s->used + cost > s->limit && _mit_sort_spill(s) != 0) {
+    return -1;
+  }
+  if (s->n == s->cap) {
+    size_t cap = s->cap ? s->cap * 2 : 1024;
+    mit_result_t *entries = _mit_realloc(s->entries,
+            cap * sizeof(mit_result_t));
+    if (entries == NULL) { return -1; }
+    s->entries = entries;
+    s->cap = cap;
+  }
+  e = &s->entries[s->n];
+  e->status = MIT_OK;
+  e->len = res->len;
+  e->value = res->value;
+  if (res->len || s->sized) {
+    /* an empty value still needs a buffer to point into */
+    if (s->bytes == NULL || s->nbytes + res->len > s->bytescap) {
+      size_t cap = s->bytescap ? s->bytescap : 4096;
+      unsigned char *bytes;
+      while (cap < s->nbytes + res->len) { cap *= 2; }
+      if ((bytes = _mit_realloc(s->bytes, cap)) == NULL) { return -1; }
+      s->bytes = bytes;
+      s->bytescap = cap;
+    }
+    /* stored as an offset until the buffer stops moving */
+    memcpy(s->bytes + s->nbytes, res->value, res->len);
+    e->value = (void *)(uintptr_t)s->nbytes;
+    s->nbytes += res->len;
+  }
+  s->n++;
+  s->used += cost;
+  return 0;
+}
+
+/* runs are read back through iterators sharing the spill file, each with a
+ * block buffer of its own */
+
+struct _mit_run_ctx_t {
+  FILE *f;
+  long pos, end;      /* part of the run not read yet */
+  unsigned char *buf;
+  size_t size, start, avail;
+  int sized;          /* records were written with their bytes */
+};
+
+static void _mit_run_free(void *ctx) {
+  struct _mit_run_ctx_t *run = ctx;
+  _mit_dealloc(run->buf);
+}
+
+/* make need bytes available after start */
+static int _mit_run_fill(struct _mit_run_ctx_t *run, size_t need) {
+  size_t left = run->avail - run->start, want;
+  if (left >= need) { return 0; }
+  memmove(run->buf, run->buf + run->start, left);
+  run->start = 0;
+  run->avail = left;
+  if (need > run->size) {
+    unsigned char *buf = _mit_realloc(run->buf, need);
+    if (buf == NULL) { return -1; }
+    run->buf = buf;
+    run->size = need;
+  }
+  want = run->size - run->avail;
+  if ((long)want > run->end - run->pos) { want = (size_t)(run->end - run->pos); }
+  if (left + want < need || fseek(run->f, run->pos, SEEK_SET) != 0
+      || fread(run->buf + run->avail, 1, want, run->f) != want) {
+    return -1;
+  }
+  run->pos += (long)want;
+  run->avail += want;
+  return 0;
+}
+
+static mit_status_t _mit_run_next(void *ctx, void **result, size_t *len) {
+  struct _mit_run_ctx_t *run = ctx;
+  if (run->start == run->avail && run->pos == run->end) {
+    return MIT_EXHAUSTED;
+  }
+  if (_mit_run_fill(run, sizeof(size_t)) != 0) { return MIT_ERROR; }
+  memcpy(len, run->buf + run->start, sizeof(size_t));
+  run->start += sizeof(size_t);
+  if (*len || run->sized) {
+    if (_mit_run_fill(run, *len) != 0) { return MIT_ERROR; }
+    *result = run->buf + run->start;
+    run->start += *len;
+  } else {
+    if (_mit_run_fill(run, sizeof(void *)) != 0) { return MIT_ERROR; }
+    memcpy(result, run->buf + run->start, sizeof(void *));
+    run->start += sizeof(void *);
+  }
+  return MIT_OK;
+}
+
+static mit_t *_mit_run_new(FILE *f, long start, long end, size_t bufsize,
+    int sized) {
+  struct _mit_run_ctx_t *run;
+  mit_t *mit = _mit_node_new(NULL, sizeof(struct _mit_run_ctx_t));
+  if (mit == NULL) { return NULL; }
+  run = mit->ctx;
+  if ((run->buf = _mit_malloc(bufsize)) == NULL) {
+    mit_free(mit);
+    return NULL;
+  }
+  run->f = f;
+  run->pos = start;
+  run->end = end;
+  run->size = bufsize;
+  run->sized = sized;
+  mit->nextsizedfn = _mit_run_next;
+  mit->freefn = _mit_run_free;
+  mit->finite = 1;
+  mit->sized = sized;
+  return mit;
+}
+
+/* the input has been drained, set up the output */
+static mit_status_t _mit_sort_finish(struct _mit_sort_ctx_t *s) {
+  size_t i, block;
+  mit_t **mits;
+
+  mit_free(s->mit);
+  s->mit = NULL;
+  if (s->nruns == 0) {
+    return _mit_sort_buffer(s) == 0 ? MIT_OK : MIT_ERROR;
+  }
+
+  /* only the block buffers are needed while merging */
+  if (s->n > 0 && _mit_sort_spill(s) != 0) { return MIT_ERROR; }
+  _mit_dealloc(s->entries);
+  _mit_dealloc(s->scratch);
+  _mit_dealloc(s->bytes);
+  s->entries = s->scratch = NULL;
+  s->bytes = NULL;
+  s->cap = s->bytescap = 0;
+  if (fflush(s->spill) != 0) { return MIT_ERROR; }
+
+  block = s->limit / s->nruns;
+  if (block < _MIT_SORT_BLOCK_MIN) { block = _MIT_SORT_BLOCK_MIN; }
+  if (block > _MIT_SORT_BLOCK_MAX) { block = _MIT_SORT_BLOCK_MAX; }
+  if ((mits = _mit_malloc(s->nruns * sizeof(mit_t *))) == NULL) {
+    return MIT_ERROR;
+  }
+  for (i = 0; i < s->nruns; i++) {
+    if ((mits[i] = _mit_run_new(s->spill, i ? s->runs[i - 1] : 0,
+                    s->runs[i], block, s->sized)) == NULL) {
+      break;
+    }
+  }
+  if (i == s->nruns) {
+    /* runs were written in input order, so a stable merge keeps the sort
+     * stable */
+    s->out = mit_merge_sorted(mits, s->nruns, s->cmp, s->ctx, 1);
+  }
+  if (s->out == NULL) {
+    while (i--) { mit_free(mits[i]); }
+  }
+  _mit_dealloc(mits);
+  return s->out ? MIT_OK : MIT_ERROR;
+}
+
+static mit_status_t _mit_sort_next(void *ctx, void **result, size_t *len) {
+  struct _mit_sort_ctx_t *s = ctx;
+  mit_result_t *res;
+
+  if (s->mit) {
+    mit_status_t status;
+    while ((res = mit_next(s->mit))->status == MIT_OK) {
+      if (_mit_sort_add(s, res) != 0) { return MIT_ERROR; }
+    }
+    if (res->status != MIT_EXHAUSTED) { return res->status; }
+    if ((status = _mit_sort_finish(s)) != MIT_OK) { return status; }
+  }
+
+  if (s->out) {
+    res = mit_next(s->out);
+    *result = res->value;
+    *len = res->len;
+    return res->status;
+  }
+  if (s->pos == s->n) { return MIT_EXHAUSTED; }
+  *result = s->entries[s->pos].value;
+  *len = s->entries[s->pos].len;
+  s->pos++;
+  return MIT_OK;
+}
+
+static int _mit_sort_size(void *ctx, size_t *remaining) {
+  struct _mit_sort_ctx_t *s = ctx;
+  if (s->mit || s->out) { return 0; }
+  *remaining = s->n - s->pos;
+  return 1;
+}
+
+static int _mit_sort_fd(void *ctx) {
+  struct _mit_sort_ctx_t *s = ctx;
+  return s->mit ? mit_pending_fd(s->mit) : -1;
+}
+
+static void _mit_sort_free(struct _mit_sort_ctx_t *s) {
+  mit_free(s->mit);
+  mit_free(s->out);
+  if (s->spill) { fclose(s->spill); }
+  _mit_dealloc(s->entries);
+  _mit_dealloc(s->scratch);
+  _mit_dealloc(s->bytes);
+  _mit_dealloc(s->runs);
+}
+
+mit_t *mit_sort(mit_t *mit, mit_cmp_fn_t cmp, void *ctx,
+    size_t mem_limit, const char *tmpdir) {
+  size_t ssize = _MIT_ROUND_UP(sizeof(struct _mit_sort_ctx_t), _MIT_ALIGNMENT);
+  size_t dirlen = tmpdir ? strlen(tmpdir) + 1 : 0;
+  struct _mit_sort_ctx_t *s;
+  mit_t *new;
+
+  if (!(new = _mit_node_new(mit->arena, ssize + dirlen))) { return NULL; }
+  s = new->ctx;
+  s->mit = mit;
+  s->cmp = cmp;
+  s->ctx = ctx;
+  s->limit = mem_limit ? mem_limit : _MIT_SORT_MEMORY;
+  s->sized = mit->sized;
+  if (tmpdir) {
+    /* runs are only created once the iterator is used */
+    memcpy((char *)s + ssize, tmpdir, dirlen);
+    s->tmpdir = (char *)s + ssize;
+  }
+  new->kind = _MIT_KIND_SORT;
+  new->nextsizedfn = _mit_sort_next;
+  new->sizefn = _mit_sort_size;
+  new->fdfn = _mit_sort_fd;
+  new->freefn = (mit_free_fn_t) _mit_sort_free;
+  new->finite = 1;
+  new->sized = mit->sized;
+  return new;
+}
+
+/***************
+ * hash tables *
+ **************/
+
+/* open addressing with linear probing.  Slots store the full hash next to
+ * the key, so most mismatches are rejected without calling the equality
+ * function, and an empty slot is marked by a zero hash.  Growing the table
+ * does not rehash everything at once: the new table is used for lookups and
+ * inserts right away while every insert moves a few slots from the old one,
+ * which is probed as well until it is empty.  Keys with a length are copied
+ * into chunks that never move. */
+
+#define _MIT_TABLE_MIN 16
+#define _MIT_TABLE_MIGRATE 8
+#define _MIT_BYTES_CHUNK ((size_t)64 << 10)
+
+struct _mit_bytes_t {
+  struct _mit_bytes_t *next;
+  size_t size;
+  size_t used;
+  unsigned char data[];
+};
+
+struct _mit_table_entry_t {
+  uint64_t hash;
+  void *value;
+  size_t len;
+  void *data;         /* owned by the user of the table */
+};
+
+struct _mit_table_t {
+  struct _mit_table_entry_t *slots;
+  struct _mit_table_entry_t *old;   /* being migrated, or NULL */
+  size_t mask;
+  size_t oldmask;
+  size_t migrate;     /* old slots before this have been moved */
+  size_t count;
+  size_t memory;      /* bytes held by slots and key copies */
+  mit_hash_fn_t hashfn;
+  mit_eq_fn_t eqfn;
+  void *ctx;
+  int sized;          /* keys have a length, even when it is 0 */
+  struct _mit_bytes_t *bytes;
+};
+
+static uint64_t _mit_mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t _mit_hash_bytes(const void *data, size_t len) {
+  const unsigned char *p = data;
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ len, w;
+  for (; len >= 8; len -= 8, p += 8) {
+    memcpy(&w, p, 8);
+    h = _mit_mix64(h ^ w);
+  }
+  if (len) {
+    w = 0;
+    memcpy(&w, p, len);
+    h = _mit_mix64(h ^ w);
+  }
+  return h;
+}
+
+/* values of sized iterators are hashed and compared by content, so empty
+ * records are all equal, others by identity */
+static uint64_t _mit_hash_default(const mit_result_t *value, int sized) {
+  return sized || value->len ? _mit_hash_bytes(value->value, value->len)
+      : _mit_mix64((uint64_t)(uintptr_t)value->value);
+}
+
+static int _mit_eq_default(const mit_result_t *a, const mit_result_t *b,
+    int sized) {
+  return a->len == b->len && (a->len
+          ? memcmp(a->value, b->value, a->len) == 0
+          : sized || a->value == b->value);
+}
+
+static void *_mit_bytes_alloc(struct _mit_bytes_t **bytes,
+    size_t len, size_t align) {
+  struct _mit_bytes_t *chunk = *bytes;
+  size_t base, offset = 0;
+  if (chunk) {
+    base = (size_t)(uintptr_t)chunk->data;
+    offset = _MIT_ROUND_UP(base + chunk->used, align) - base;
+  }
+  if (chunk == NULL || offset > chunk->size || chunk->size - offset < len) {
+    size_t size = (len > _MIT_BYTES_CHUNK ? len : _MIT_BYTES_CHUNK) + align;
+    if ((chunk = _mit_malloc(sizeof(*chunk) + size)) == NULL) { return NULL; }
+    chunk->next = *bytes;
+    chunk->size = size;
+    *bytes = chunk;
+    base = (size_t)(uintptr_t)chunk->data;
+    offset = _MIT_ROUND_UP(base, align) - base;
+  }
+  chunk->used = offset + len;
+  return chunk->data + offset;
+}
+
+static void *_mit_bytes_copy(struct _mit_bytes_t **bytes,
+    const void *src, size_t len) {
+  void *dst = _mit_bytes_alloc(bytes, len, 1);
+  if (dst && len) { memcpy(dst, src, len); }
+  return dst;
+}
+
+static void _mit_bytes_free(struct _mit_bytes_t *bytes) {
+  while (bytes) {
+    struct _mit_bytes_t *next = bytes->next;
+    _mit_dealloc(bytes);
+    bytes = next;
+  }
+}
+
+static int _mit_table_init(struct _mit_table_t *t,
+    mit_hash_fn_t hashfn, mit_eq_fn_t eqfn, void *ctx, int sized) {
+  memset(t, 0, sizeof(*t));
+  t->hashfn = hashfn;
+  t->eqfn = eqfn;
+  t->ctx = ctx;
+  t->sized = sized;
+  t->mask = _MIT_TABLE_MIN - 1;
+  t->slots = _mit_malloc(_MIT_TABLE_MIN * sizeof(struct _mit_table_entry_t));
+  if (t->slots == NULL) { return -1; }
+  memset(t->slots, 0, _MIT_TABLE_MIN * sizeof(struct _mit_table_entry_t));
+  t->memory = _MIT_TABLE_MIN * sizeof(struct _mit_table_entry_t);
+  return 0;
+}
+
+static void _mit_table_fini(struct _mit_table_t *t) {
+  _mit_dealloc(t->slots);
+  _mit_dealloc(t->old);
+  _mit_bytes_free(t->bytes);
+}
+
+static uint64_t _mit_table_hash(struct _mit_table_t *t,
+    const mit_result_t *key) {
+  uint64_t h = t->hashfn ? t->hashfn(key, t->ctx)
+      : _mit_hash_default(key, t->sized);
+  return h ? h : 1;
+}
+
+static struct _mit_table_entry_t *_mit_table_probe(struct _mit_table_t *t,
+    struct _mit_table_entry_t *slots, size_t mask,
+    const mit_result_t *key, uint64_t hash) {
+  size_t i;
+  for (i = (size_t)hash & mask; slots[i].hash; i = (i + 1) & mask) {
+    if (slots[i].hash == hash) {
+      mit_result_t stored;
+      stored.status = MIT_OK;
+      stored.value = slots[i].value;
+      stored.len = slots[i].len;
+      if (t->eqfn ? t->eqfn(&stored, key, t->ctx)
+          : _mit_eq_default(&stored, key, t->sized)) {
+        return &slots[i];
+      }
+    }
+  }
+  return NULL;
+}
+
+static struct _mit_table_entry_t *_mit_table_find(struct _mit_table_t *t,
+    const mit_result_t *key, uint64_t hash) {
+  struct _mit_table_entry_t *e;
+  if ((e = _mit_table_probe(t, t->slots, t->mask, key, hash)) != NULL) {
+    return e;
+  }
+  /* keys still in the old table were not inserted into the new one */
+  return t->old ? _mit_table_probe(t, t->old, t->oldmask, key, hash) : NULL;
+}
+
+static struct _mit_table_entry_t *_mit_table_place(struct _mit_table_t *t,
+    uint64_t hash) {
+  size_t i = (size_t)hash & t->mask;
+  while (t->slots[i].hash) { i = (i + 1) & t->mask; }
+  t->slots[i].hash = hash;
+  return &t->slots[i];
+}
+
+static void _mit_table_migrate(struct _mit_table_t *t) {
+  size_t end = t->migrate + _MIT_TABLE_MIGRATE;
+  if (end > t->oldmask + 1) { end = t->oldmask + 1; }
+  for (; t->migrate < end; t->migrate++) {
+    struct _mit_table_entry_t *src = &t->old[t->migrate];
+    if (src->hash) { *_mit_table_place(t, src->hash) = *src; }
+  }
+  if (t->migrate > t->oldmask) {
+    _mit_dealloc(t->old);
+    t->old = NULL;
+    t->memory -= (t->oldmask + 1) * sizeof(struct _mit_table_entry_t);
+  }
+}
+
+/* keep the load factor at or below 3/4 */
+static int _mit_table_grow(struct _mit_table_t *t) {
+  size_t size = 2 * (t->mask + 1);
+  struct _mit_table_entry_t *slots;
+  /* a growth only happens after the last migration has finished */
+  while (t->old) { _mit_table_migrate(t); }
+  if ((slots = _mit_malloc(size * sizeof(*slots))) == NULL) { return -1; }
+  memset(slots, 0, size * sizeof(*slots));
+  t->old = t->slots;
+  t->oldmask = t->mask;
+  t->migrate = 0;
+  t->slots = slots;
+  t->mask = size - 1;
+  t->memory += size * sizeof(*slots);
+  return 0;
+}
+
+/* add a key known not to be present */
+static struct _mit_table_entry_t *_mit_table_insert(struct _mit_table_t *t,
+    const mit_result_t *key, uint64_t hash) {
+  struct _mit_table_entry_t *e;
+  struct _mit_bytes_t *chunk = t->bytes;
+  void *value = key->value;
+  /* empty keys are copied too, so they never point into a reused buffer */
+  if (key->len || t->sized) {
+    if ((value = _mit_bytes_copy(&t->bytes, key->value, key->len)) == NULL) {
+      return NULL;
+    }
+    if (t->bytes != chunk) { t->memory += sizeof(*chunk) + t->bytes->size; }
+  }
+  if ((t->count + 1) * 4 > (t->mask + 1) * 3 && _mit_table_grow(t) != 0) {
+    return NULL;
+  }
+  if (t->old) { _mit_table_migrate(t); }
+  e = _mit_table_place(t, hash);
+  e->value = value;
+  e->len = key->len;
+  e->data = NULL;
+  t->count++;
+  return e;
+}
+
+/**********************
+ * distinct iterators *
+ *********************/
+
+/* both are grep stages, so they fuse with neighbouring greps and maps and
+ * filter whole batches */
+
+static mit_status_t _mit_distinct_grep(void *value, size_t len,
+    void *ctx, int *matches) {
+  struct _mit_table_t *t = ctx;
+  mit_result_t key;
+  uint64_t hash;
+  key.status = MIT_OK;
+  key.value = value;
+  key.len = len;
+  hash = _mit_table_hash(t, &key);
+  if (_mit_table_find(t, &key, hash)) {
+    *matches = 0;
+    return MIT_OK;
+  }
+  *matches = 1;
+  return _mit_table_insert(t, &key, hash) ? MIT_OK : MIT_ERROR;
+}
+
+static void _mit_distinct_free(void *ctx) {
+  _mit_table_fini(ctx);
+  _mit_dealloc(ctx);
+}
+
+mit_t *mit_distinct(mit_t *mit, mit_hash_fn_t hashfn, mit_eq_fn_t eqfn,
+    void *ctx) {
+  struct _mit_table_t *t = _mit_malloc(sizeof(struct _mit_table_t));
+  mit_t *new;
+  if (t == NULL) { return NULL; }
+  if (_mit_table_init(t, hashfn, eqfn, ctx, mit->sized) != 0) {
+    _mit_dealloc(t);
+    return NULL;
+  }
+  if (!(new = mit_grep_sized(mit, _mit_distinct_grep, t,
+              _mit_distinct_free))) {
+    _mit_distinct_free(t);
+  }
+  return new;
+}
+
+/* split block Bloom filter: each key sets one bit in each of the eight
+ * words of a single 32-byte block, so a lookup touches one cache line */
+
+#define _MIT_BLOOM_WORDS 8
+
+struct _mit_bloom_t {
+  mit_hash_fn_t hashfn;
+  void *ctx;
+  int sized;
+  size_t nblocks;
+  uint32_t blocks[][_MIT_BLOOM_WORDS];
+};
+
+static const uint32_t _mit_bloom_salt[_MIT_BLOOM_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static mit_status_t _mit_bloom_grep(void *value, size_t len,
+    void *ctx, int *matches) {
+  struct _mit_bloom_t *b = ctx;
+  mit_result_t key;
+  uint64_t hash;
+  uint32_t *block, lo;
+  int seen = 1, i;
+  key.status = MIT_OK;
+  key.value = value;
+  key.len = len;
+  hash = b->hashfn ? b->hashfn(&key, b->ctx)
+      : _mit_hash_default(&key, b->sized);
+  block = b->blocks[((hash >> 32) * b->nblocks) >> 32];
+  lo = (uint32_t)hash;
+  for (i = 0; i < _MIT_BLOOM_WORDS; i++) {
+    uint32_t bit = (uint32_t)1 << ((lo * _mit_bloom_salt[i]) >> 27);
+    if (!(block[i] & bit)) {
+      seen = 0;
+      block[i] |= bit;
+    }
+  }
+  *matches = !seen;
+  return MIT_OK;
+}
+
+mit_t *mit_distinct_approx(mit_t *mit, mit_hash_fn_t hashfn, void *ctx,
+    size_t mem_limit) {
+  size_t nblocks = mem_limit / sizeof(uint32_t[_MIT_BLOOM_WORDS]), size;
+  struct _mit_bloom_t *b;
+  mit_t *new;
+  if (nblocks == 0) { nblocks = 1; }
+  if (nblocks > UINT32_MAX) { nblocks = UINT32_MAX; }
+  size = sizeof(struct _mit_bloom_t) + nblocks * sizeof(b->blocks[0]);
+  if ((b = _mit_malloc(size)) == NULL) { return NULL; }
+  memset(b, 0, size);
+  b->hashfn = hashfn;
+  b->ctx = ctx;
+  b->sized = mit->sized;
+  b->nblocks = nblocks;
+  if (!(new = mit_grep_sized(mit, _mit_bloom_grep, b, _mit_dealloc))) {
+    _mit_dealloc(b);
+  }
+  return new;
+}
+
+/***********************
+ * aggregate iterators *
+ **********************/
+
+/* values are pulled one at a time rather than in batches, as sized sources
+ * may reuse their buffer for every value */
+mit_status_t mit_fold(mit_t *mit, mit_fold_fn_t fn, void *ctx, void **acc) {
+  mit_result_t *res;
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    if (fn(*acc, res->value, res->len, ctx, acc) != MIT_OK) {
+      return MIT_ERROR;
+    }
+  }
+  return res->status == MIT_EXHAUSTED ? MIT_OK : res->status;
+}
+
+mit_status_t mit_reduce(mit_t *mit, mit_fold_fn_t fn, void *ctx, void **acc) {
+  mit_result_t *res = mit_next(mit);
+  if (res->status != MIT_OK) { return res->status; }
+  *acc = res->value;
+  return mit_fold(mit, fn, ctx, acc);
+}
+
+/* groups are kept in a hash table keyed by the result of keyfn.  With a
+ * memory limit, values whose key is not in the table once it is full are
+ * written to one of several partition files chosen by the top bits of the
+ * hash.  After the input is drained and the groups in memory have been
+ * returned, each partition is aggregated in turn the same way, splitting it
+ * further on the next bits of the hash if it does not fit either. */
+
+#define _MIT_GROUP_BITS 4
+#define _MIT_GROUP_FANOUT (1 << _MIT_GROUP_BITS)
+#define _MIT_GROUP_LEVELS (64 / _MIT_GROUP_BITS)
+
+struct _mit_group_part_t {
+  struct _mit_group_part_t *next;
+  FILE *f;
+  long end;
+  unsigned level;
+};
+
+struct _mit_group_ctx_t {
+  mit_t *mit;         /* input being aggregated, NULL while returning groups */
+  FILE *in;           /* partition file mit reads from, if any */
+  mit_map_sized_fn_t keyfn;
+  mit_init_fn_t initfn;
+  mit_fold_fn_t combine;
+  void *ctx;
+  mit_free_fn_t freefn;
+  size_t limit;       /* 0 to keep every group in memory */
+  const char *tmpdir;
+
+  struct _mit_table_t table;
+  unsigned level;     /* of the input being aggregated */
+  int spilling;       /* new groups at this level go to the partitions */
+  FILE *parts[_MIT_GROUP_FANOUT];
+  struct _mit_group_part_t *pending;
+  size_t pos;         /* next slot to return */
+  int returned;       /* pair holds an accumulator to release */
+  mit_pair_t pair;
+};
+
+/* whether a new group would take the table over the limit */
+static int _mit_group_full(struct _mit_group_ctx_t *s, size_t keylen) {
+  struct _mit_table_t *t = &s->table;
+  size_t need = keylen;
+  if ((t->count + 1) * 4 > (t->mask + 1) * 3) {
+    need += 2 * (t->mask + 1) * sizeof(struct _mit_table_entry_t);
+  }
+  return t->memory + need > s->limit;
+}
+
+static mit_status_t _mit_group_spill(struct _mit_group_ctx_t *s,
+    uint64_t hash, void *value, size_t len) {
+  unsigned shift = 64 - _MIT_GROUP_BITS * (s->level + 1);
+  FILE **f = &s->parts[(hash >> shift) & (_MIT_GROUP_FANOUT - 1)];
+  if (*f == NULL && (*f = _mit_sort_tmpfile(s->tmpdir)) == NULL) {
+    return MIT_ERROR;
+  }
+  return _mit_record_write(*f, value, len, s->table.sized) == 0
+      ? MIT_OK : MIT_ERROR;
+}
+
+static mit_status_t _mit_group_add(struct _mit_group_ctx_t *s,
+    void *value, size_t len) {
+  struct _mit_table_t *t = &s->table;
+  struct _mit_table_entry_t *e;
+  mit_result_t key;
+  uint64_t hash;
+
+  key.status = MIT_OK;
+  key.value = value;
+  key.len = len;
+  if (s->keyfn && s->keyfn(value, len, s->ctx,
+          &key.value, &key.len) != MIT_OK) {
+    return MIT_ERROR;
+  }
+  hash = _mit_table_hash(t, &key);
+  if ((e = _mit_table_find(t, &key, hash)) == NULL) {
+    /* once a key has spilled, the table must not take it back in even
+       if finishing a migration frees memory */
+    if (s->limit && s->level < _MIT_GROUP_LEVELS && (s->spilling
+            || (t->count > 0 && _mit_group_full(s, key.len)))) {
+      s->spilling = 1;
+      return _mit_group_spill(s, hash, value, len);
+    }
+    if ((e = _mit_table_insert(t, &key, hash)) == NULL) { return MIT_ERROR; }
+    if (s->initfn && s->initfn(e->value, e->len, s->ctx,
+            &e->data) != MIT_OK) {
+      return MIT_ERROR;
+    }
+  }
+  return s->combine(e->data, value, len, s->ctx, &e->data) == MIT_OK
+      ? MIT_OK : MIT_ERROR;
+}
+
+/* the input has been drained, queue its partitions */
+static int _mit_group_finish(struct _mit_group_ctx_t *s) {
+  struct _mit_table_t *t = &s->table;
+  size_t i;
+  mit_free(s->mit);
+  s->mit = NULL;
+  if (s->in) {
+    fclose(s->in);
+    s->in = NULL;
+  }
+  for (i = 0; i < _MIT_GROUP_FANOUT; i++) {
+    struct _mit_group_part_t *part;
+    FILE *f = s->parts[i];
+    if (f == NULL) { continue; }
+    s->parts[i] = NULL;
+    if ((part = _mit_malloc(sizeof(*part))) == NULL || fflush(f) != 0
+        || (part->end = ftell(f)) < 0) {
+      _mit_dealloc(part);
+      fclose(f);
+      return -1;
+    }
+    part->f = f;
+    part->level = s->level + 1;
+    part->next = s->pending;
+    s->pending = part;
+  }
+  /* groups are returned in slot order */
+  while (t->old) { _mit_table_migrate(t); }
+  s->pos = 0;
+  return 0;
+}
+
+/* aggregate the next partition in a fresh table */
+static int _mit_group_load(struct _mit_group_ctx_t *s) {
+  struct _mit_group_part_t *part = s->pending;
+  size_t block = s->limit / _MIT_GROUP_FANOUT;
+  int sized = s->table.sized;
+  if (block < _MIT_SORT_BLOCK_MIN) { block = _MIT_SORT_BLOCK_MIN; }
+  if (block > _MIT_SORT_BLOCK_MAX) { block = _MIT_SORT_BLOCK_MAX; }
+  _mit_table_fini(&s->table);
+  if (_mit_table_init(&s->table, NULL, NULL, NULL, sized) != 0) { return -1; }
+  if ((s->mit = _mit_run_new(part->f, 0, part->end, block, sized)) == NULL) {
+    return -1;
+  }
+  s->pending = part->next;
+  s->in = part->f;
+  s->level = part->level;
+  s->spilling = 0;
+  _mit_dealloc(part);
+  return 0;
+}
+
+static mit_status_t _mit_group_next(void *ctx, void **result, size_t *len) {
+  struct _mit_group_ctx_t *s = ctx;
+  struct _mit_table_t *t = &s->table;
+
+  if (s->returned) {
+    if (s->freefn) { s->freefn(s->pair.second); }
+    s->returned = 0;
+  }
+  for (;;) {
+    if (s->mit) {
+      mit_result_t *res;
+      while ((res = mit_next(s->mit))->status == MIT_OK) {
+        if (_mit_group_add(s, res->value, res->len) != MIT_OK) {
+          return MIT_ERROR;
+        }
+      }
+      if (res->status != MIT_EXHAUSTED) { return res->status; }
+      if (_mit_group_finish(s) != 0) { return MIT_ERROR; }
+    }
+    while (s->pos <= t->mask) {
+      struct _mit_table_entry_t *e = &t->slots[s->pos++];
+      if (e->hash) {
+        /* the accumulator is released on the next retrieval instead */
+        e->hash = 0;
+        s->pair.first = e->value;
+        s->pair.firstlen = e->len;
+        s->pair.second = e->data;
+        s->pair.secondlen = 0;
+        s->returned = 1;
+        *result = &s->pair;
+        *len = 0;
+        return MIT_OK;
+      }
+    }
+    if (s->pending == NULL) { return MIT_EXHAUSTED; }
+    if (_mit_group_load(s) != 0) { return MIT_ERROR; }
+  }
+}
+
+static int _mit_group_fd(void *ctx) {
+  struct _mit_group_ctx_t *s = ctx;
+  return s->mit && s->in == NULL ? mit_pending_fd(s->mit) : -1;
+}
+
+static void _mit_group_free(struct _mit_group_ctx_t *s) {
+  struct _mit_table_t *t = &s->table;
+  size_t i;
+  if (s->freefn) {
+    if (s->returned) { s->freefn(s->pair.second); }
+    for (i = 0; i <= t->mask; i++) {
+      if (t->slots[i].hash) { s->freefn(t->slots[i].data); }
+    }
+    /* slots before migrate have been moved to the new table */
+    for (i = t->migrate; t->old && i <= t->oldmask; i++) {
+      if (t->old[i].hash) { s->freefn(t->old[i].data); }
+    }
+  }
+  _mit_table_fini(t);
+  mit_free(s->mit);
+  if (s->in) { fclose(s->in); }
+  for (i = 0; i < _MIT_GROUP_FANOUT; i++) {
+    if (s->parts[i]) { fclose(s->parts[i]); }
+  }
+  while (s->pending) {
+    struct _mit_group_part_t *next = s->pending->next;
+    fclose(s->pending->f);
+    _mit_dealloc(s->pending);
+    s->pending = next;
+  }
+}
+
+static mit_t *_mit_group_new(mit_t *mit, mit_map_sized_fn_t keyfn,
+    mit_init_fn_t init, mit_fold_fn_t combine, void *ctx,
+    mit_free_fn_t freefn, size_t limit, const char *tmpdir) {
+  size_t gsize = _MIT_ROUND_UP(sizeof(struct _mit_group_ctx_t), _MIT_ALIGNMENT);
+  size_t dirlen = tmpdir ? strlen(tmpdir) + 1 : 0;
+  struct _mit_group_ctx_t *s;
+  mit_t *new;
+
+  if (!(new = _mit_node_new(mit->arena, gsize + dirlen))) { return NULL; }
+  s = new->ctx;
+  /* keys are sized if the values they are taken from are */
+  if (_mit_table_init(&s->table, NULL, NULL, NULL, mit->sized) != 0) {
+    mit_free(new);
+    return NULL;
+  }
+  s->mit = mit;
+  s->keyfn = keyfn;
+  s->initfn = init;
+  s->combine = combine;
+  s->ctx = ctx;
+  s->freefn = freefn;
+  s->limit = limit;
+  if (tmpdir) {
+    memcpy((char *)s + gsize, tmpdir, dirlen);
+    s->tmpdir = (char *)s + gsize;
+  }
+  new->kind = _MIT_KIND_GROUP;
+  new->nextsizedfn = _mit_group_next;
+  new->fdfn = _mit_group_fd;
+  new->freefn = (mit_free_fn_t) _mit_group_free;
+  new->finite = 1;
+  return new;
+}
+
+mit_t *mit_group_aggregate(mit_t *mit, mit_map_sized_fn_t keyfn,
+    mit_init_fn_t init, mit_fold_fn_t combine, void *ctx,
+    mit_free_fn_t freefn) {
+  return _mit_group_new(mit, keyfn, init, combine, ctx, freefn, 0, NULL);
+}
+
+mit_t *mit_group_aggregate_spill(mit_t *mit, mit_map_sized_fn_t keyfn,
+    mit_init_fn_t init, mit_fold_fn_t combine, void *ctx,
+    mit_free_fn_t freefn, size_t mem_limit, const char *tmpdir) {
+  return _mit_group_new(mit, keyfn, init, combine, ctx, freefn,
+          mem_limit ? mem_limit : _MIT_SORT_MEMORY, tmpdir);
+}
+
+/******************
+ * join iterators *
+ *****************/
+
+/* the build side is drained into a hash table on the first retrieval and
+ * freed.  Values sharing a key hang off their table entry in a circular list
+ * whose entry points at the last row, so rows are appended in constant time
+ * and read back in build order.  Rows and copies of sized values are carved
+ * from the table's chunks, so building costs no allocation per value. */
+
+struct _mit_join_row_t {
+  struct _mit_join_row_t *next;
+  void *value;
+  size_t len;
+};
+
+struct _mit_join_ctx_t {
+  mit_t *build;       /* NULL once the table is built */
+  mit_t *probe;
+  mit_map_sized_fn_t build_key;
+  mit_map_sized_fn_t probe_key;
+  void *ctx;
+  struct _mit_table_t table;
+  struct _mit_join_row_t *row;  /* next match for the current probe value */
+  struct _mit_join_row_t *last;
+  mit_pair_t pair;
+};
+
+static mit_status_t _mit_join_add(struct _mit_join_ctx_t *j,
+    void *value, size_t len) {
+  struct _mit_table_t *t = &j->table;
+  struct _mit_table_entry_t *e;
+  struct _mit_join_row_t *row;
+  mit_result_t key;
+  uint64_t hash;
+
+  key.status = MIT_OK;
+  key.value = value;
+  key.len = len;
+  if (j->build_key && j->build_key(value, len, j->ctx,
+          &key.value, &key.len) != MIT_OK) {
+    return MIT_ERROR;
+  }
+  hash = _mit_table_hash(t, &key);
+  if ((row = _mit_bytes_alloc(&t->bytes, sizeof(*row),
+                  _MIT_ALIGNMENT)) == NULL) {
+    return MIT_ERROR;
+  }
+  row->len = len;
+  row->value = value;
+  if ((len || j->build->sized)
+      && (row->value = _mit_bytes_copy(&t->bytes, value, len)) == NULL) {
+    return MIT_ERROR;
+  }
+  if ((e = _mit_table_find(t, &key, hash)) != NULL) {
+    struct _mit_join_row_t *last = e->data;
+    row->next = last->next;
+    last->next = row;
+  } else {
+    if ((e = _mit_table_insert(t, &key, hash)) == NULL) { return MIT_ERROR; }
+    row->next = row;
+  }
+  e->data = row;
+  return MIT_OK;
+}
+
+static mit_status_t _mit_join_next(void *ctx, void **result, size_t *len) {
+  struct _mit_join_ctx_t *j = ctx;
+  struct _mit_table_t *t = &j->table;
+  mit_result_t *res;
+
+  if (j->build) {
+    while ((res = mit_next(j->build))->status == MIT_OK) {
+      if (_mit_join_add(j, res->value, res->len) != MIT_OK) {
+        return MIT_ERROR;
+      }
+    }
+    if (res->status != MIT_EXHAUSTED) { return res->status; }
+    mit_free(j->build);
+    j->build = NULL;
+    while (t->old) { _mit_table_migrate(t); }
+    if (t->count == 0) {
+      /* nothing can match, so the probe side is never read */
+      mit_free(j->probe);
+      j->probe = NULL;
+    }
+  }
+  if (j->probe == NULL) { return MIT_EXHAUSTED; }
+
+  for (;;) {
+    if (j->row) {
+      j->pair.first = j->row->value;
+      j->pair.firstlen = j->row->len;
+      j->row = j->row == j->last ? NULL : j->row->next;
+      *result = &j->pair;
+      *len = 0;
+      return MIT_OK;
+    }
+    if ((res = mit_next(j->probe))->status == MIT_OK) {
+      struct _mit_table_entry_t *e;
+      mit_result_t key = *res;
+      if (j->probe_key && j->probe_key(res->value, res->len, j->ctx,
+              &key.value, &key.len) != MIT_OK) {
+        return MIT_ERROR;
+      }
+      if ((e = _mit_table_find(t, &key, _mit_table_hash(t, &key)))) {
+        /* the probe value stays valid until its matches are returned */
+        j->last = e->data;
+        j->row = j->last->next;
+        j->pair.second = res->value;
+        j->pair.secondlen = res->len;
+      }
+      continue;
+    }
+    return res->status;
+  }
+}
+
+static int _mit_join_fd(void *ctx) {
+  struct _mit_join_ctx_t *j = ctx;
+  if (j->build) { return mit_pending_fd(j->build); }
+  return j->probe ? mit_pending_fd(j->probe) : -1;
+}
+
+static void _mit_join_free(struct _mit_join_ctx_t *j) {
+  mit_free(j->build);
+  mit_free(j->probe);
+  _mit_table_fini(&j->table);
+}
+
+mit_t *mit_hash_join(mit_t *build, mit_t *probe,
+    mit_map_sized_fn_t build_key, mit_map_sized_fn_t probe_key, void *ctx) {
+  struct _mit_join_ctx_t *j;
+  mit_t *new;
+
+  if (!(new = _mit_node_new(probe->arena, sizeof(struct _mit_join_ctx_t)))) {
+    return NULL;
+  }
+  j = new->ctx;
+  /* keys are sized if the values of both sides are */
+  if (_mit_table_init(&j->table, NULL, NULL, NULL,
+          build->sized && probe->sized) != 0) {
+    mit_free(new);
+    return NULL;
+  }
+  j->build = build;
+  j->probe = probe;
+  j->build_key = build_key;
+  j->probe_key = probe_key;
+  j->ctx = ctx;
+  new->kind = _MIT_KIND_JOIN;
+  new->nextsizedfn = _mit_join_next;
+  new->fdfn = _mit_join_fd;
+  new->freefn = (mit_free_fn_t) _mit_join_free;
+  new->finite = probe->finite;
+  return new;
+}
+
+/*******************
+ * array iterators *
+ ******************/
+
+/* values are stored contiguously, so batches are copied directly and skips
+ * and sizes are simple arithmetic */
+
+struct _mit_array_ctx_t {
+  unsigned char *base;
+  size_t pos;
+  size_t n;
+  size_t stride;
+  int addresses;      /* return element addresses instead of stored values */
+};
+
+static mit_status_t _mit_array_next(void *ctx, void **result) {
+  struct _mit_array_ctx_t *actx = ctx;
+  unsigned char *elem;
+  if (actx->pos >= actx->n) { return MIT_EXHAUSTED; }
+  elem = actx->base + actx->pos++ * actx->stride;
+  *result = actx->addresses ? (void *)elem : *(void **)elem;
+  return MIT_OK;
+}
+
+static mit_status_t _mit_array_next_batch(void *ctx,
+    void **values, size_t n, size_t *count) {
+  struct _mit_array_ctx_t *actx = ctx;
+  unsigned char *elem = actx->base + actx->pos * actx->stride;
+  size_t i;
+  if (n > actx->n - actx->pos) { n = actx->n - actx->pos; }
+  if (actx->addresses) {
+    for (i = 0; i < n; i++, elem += actx->stride) { values[i] = elem; }
+  } else if (actx->stride == sizeof(void *)) {
+    memcpy(values, elem, n * sizeof(void *));
+  } else {
+    for (i = 0; i < n; i++, elem += actx->stride) {
+      values[i] = *(void **)elem;
+    }
+  }
+  actx->pos += n;
+  *count = n;
+  return actx->pos < actx->n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static mit_status_t _mit_array_skip(void *ctx, size_t n, size_t *skipped) {
+  struct _mit_array_ctx_t *actx = ctx;
+  size_t left = actx->n - actx->pos;
+  *skipped = n < left ? n : left;
+  actx->pos += *skipped;
+  return *skipped == n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static int _mit_array_size(void *ctx, size_t *remaining) {
+  struct _mit_array_ctx_t *actx = ctx;
+  *remaining = actx->n - actx->pos;
+  return 1;
+}
+
+static mit_t *_mit_array_new(void *base, size_t n, size_t stride,
+    int addresses) {
+  struct _mit_array_ctx_t *actx;
+  mit_t *mit;
+  if (!(mit = _mit_node_new(NULL, sizeof(struct _mit_array_ctx_t)))) {
+    return NULL;
+  }
+  actx = mit->ctx;
+  actx->base = base;
+  actx->n = n;
+  actx->stride = stride;
+  actx->addresses = addresses;
+  mit->kind = _MIT_KIND_ARRAY;
+  mit->nextfn = _mit_array_next;
+  mit->batchfn = _mit_array_next_batch;
+  mit->skipfn = _mit_array_skip;
+  mit->sizefn = _mit_array_size;
+  mit->finite = 1;
+  return mit;
+}
+
+mit_t *mit_from_array(void **values, size_t n) {
+  return _mit_array_new(values, n, sizeof(void *), 0);
+}
+
+mit_t *mit_from_strided(void *base, size_t n, size_t stride) {
+  return _mit_array_new(base, n, stride, 1);
+}
+
+mit_t *mit_from_strv(char **strv) {
+  size_t n = 0;
+  while (strv[n]) { n++; }
+  return _mit_array_new(strv, n, sizeof(char *), 0);
+}
+
+int mit_contiguous(mit_t *mit, void **base, size_t *count, size_t *stride) {
+  struct _mit_array_ctx_t *actx = mit->ctx;
+  size_t pos;
+  if (mit->kind != _MIT_KIND_ARRAY) { return 0; }
+  pos = actx->pos;
+  if (mit->next_set && mit->value.status == MIT_OK) { pos--; }
+  *base = actx->base + pos * actx->stride;
+  *count = mit_is_ready(mit) ? actx->n - pos : 0;
+  *stride = actx->stride;
+  return 1;
+}
+
+/******************
+ * range iterator *
+ *****************/
+
+struct _mit_range_ctx_t {
+  intptr_t next;
+  intptr_t step;
+  size_t remaining;
+};
+
+static mit_status_t _mit_range_next(void *ctx, void **result) {
+  struct _mit_range_ctx_t *rctx = ctx;
+  if (rctx->remaining == 0) { return MIT_EXHAUSTED; }
+  *result = MIT_PTR(rctx->next);
+  rctx->next += rctx->step;
+  rctx->remaining--;
+  return MIT_OK;
+}
+
+static mit_status_t _mit_range_next_batch(void *ctx,
+    void **values, size_t n, size_t *count) {
+  struct _mit_range_ctx_t *rctx = ctx;
+  intptr_t next = rctx->next, step = rctx->step;
+  size_t i;
+  if (n > rctx->remaining) { n = rctx->remaining; }
+  for (i = 0; i < n; i++, next += step) { values[i] = MIT_PTR(next); }
+  rctx->next = next;
+  rctx->remaining -= n;
+  *count = n;
+  return rctx->remaining ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static mit_status_t _mit_range_skip(void *ctx, size_t n, size_t *skipped) {
+  struct _mit_range_ctx_t *rctx = ctx;
+  *skipped = n < rctx->remaining ? n : rctx->remaining;
+  rctx->next += (intptr_t)(*skipped) * rctx->step;
+  rctx->remaining -= *skipped;
+  return *skipped == n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static int _mit_range_size(void *ctx, size_t *remaining) {
+  struct _mit_range_ctx_t *rctx = ctx;
+  *remaining = rctx->remaining;
+  return 1;
+}
+
+mit_t *mit_range(intptr_t start, intptr_t stop, intptr_t step) {
+  struct _mit_range_ctx_t *rctx;
+  mit_t *mit;
+  if (step == 0) { return NULL; }
+  if (!(mit = _mit_node_new(NULL, sizeof(struct _mit_range_ctx_t)))) {
+    return NULL;
+  }
+  rctx = mit->ctx;
+  rctx->next = start;
+  rctx->step = step;
+  if (step > 0 && stop > start) {
+    rctx->remaining = ((uintptr_t)stop - start - 1) / step + 1;
+  } else if (step < 0 && stop < start) {
+    rctx->remaining = ((uintptr_t)start - stop - 1) / -(uintptr_t)step + 1;
+  }
+  mit->kind = _MIT_KIND_RANGE;
+  mit->nextfn = _mit_range_next;
+  mit->batchfn = _mit_range_next_batch;
+  mit->skipfn = _mit_range_skip;
+  mit->sizefn = _mit_range_size;
+  mit->finite = 1;
+  return mit;
+}
+
+#ifdef MIT_POSIX
+
+/******************
+ * file iterators *
+ *****************/
+
+/* records are returned with their lengths as pointers into a read-only
+ * mapping of the whole file, located with
+ * memchr, which the C library vectorizes.  The kernel is told the mapping is
+ * read sequentially and pages behind the read position are periodically
+ * released, so files larger than memory can be read without pressure;
+ * released pages are simply read back from the file if touched again. */
+
+#define _MIT_LINES_RELEASE ((size_t)32 << 20)
+
+struct _mit_lines_ctx_t {
+  unsigned char *map;
+  size_t size;
+  size_t pos;
+  size_t released;    /* pages before this offset have been released */
+  int delim;
+};
+
+static void _mit_lines_free(void *ctx) {
+  struct _mit_lines_ctx_t *lctx = ctx;
+  if (lctx->map) { munmap(lctx->map, lctx->size); }
+}
+
+static void _mit_lines_release(struct _mit_lines_ctx_t *lctx) {
+  size_t page, end;
+  if (lctx->pos - lctx->released < _MIT_LINES_RELEASE) { return; }
+  page = (size_t)sysconf(_SC_PAGESIZE);
+  end = lctx->pos / page * page;
+  /* glibc treats POSIX_MADV_DONTNEED as a no-op; madvise really drops the
+   * pages, which is safe on a read-only private file mapping */
+#ifdef MADV_DONTNEED
+  madvise(lctx->map + lctx->released, end - lctx->released, MADV_DONTNEED);
+#else
+  posix_madvise(lctx->map + lctx->released, end - lctx->released,
+      POSIX_MADV_DONTNEED);
+#endif
+  lctx->released = end;
+}
+
+/* find the end of the record at the current position; returns its length
+ * and advances past the delimiter */
+static size_t _mit_lines_scan(struct _mit_lines_ctx_t *lctx) {
+  const unsigned char *start = lctx->map + lctx->pos, *end;
+  size_t left = lctx->size - lctx->pos, len;
+  if ((end = memchr(start, lctx->delim, left)) == NULL) {
+    lctx->pos = lctx->size;
+    return left;
+  }
+  len = (size_t)(end - start);
+  lctx->pos += len + 1;
+  return len;
+}
+
+static mit_status_t _mit_lines_next(void *ctx, void **result, size_t *len) {
+  struct _mit_lines_ctx_t *lctx = ctx;
+  if (lctx->pos >= lctx->size) { return MIT_EXHAUSTED; }
+  _mit_lines_release(lctx);
+  *result = lctx->map + lctx->pos;
+  *len = _mit_lines_scan(lctx);
+  return MIT_OK;
+}
+
+static mit_status_t _mit_lines_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_lines_ctx_t *lctx = ctx;
+  size_t i;
+  _mit_lines_release(lctx);
+  for (i = 0; i < n && lctx->pos < lctx->size; i++) {
+    size_t len;
+    values[i] = lctx->map + lctx->pos;
+    len = _mit_lines_scan(lctx);
+    if (lens) { lens[i] = len; }
+  }
+  *count = i;
+  return lctx->pos < lctx->size ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static mit_status_t _mit_lines_skip(void *ctx, size_t n, size_t *skipped) {
+  struct _mit_lines_ctx_t *lctx = ctx;
+  size_t i;
+  for (i = 0; i < n && lctx->pos < lctx->size; i++) { _mit_lines_scan(lctx); }
+  *skipped = i;
+  return i == n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+mit_t *mit_from_file_lines(const char *path, int delim) {
+  struct _mit_lines_ctx_t *lctx;
+  unsigned char *map = NULL;
+  struct stat st;
+  mit_t *mit;
+  int fd, err;
+
+  if ((fd = open(path, O_RDONLY)) < 0) { return NULL; }
+  if (fstat(fd, &st) != 0) { goto error; }
+  if ((uintmax_t)st.st_size > SIZE_MAX) {
+    errno = EFBIG;
+    goto error;
+  }
+  if (st.st_size > 0) {
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { goto error; }
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+  }
+  close(fd); /* the mapping holds its own reference to the file */
+
+  if (!(mit = _mit_node_new(NULL, sizeof(struct _mit_lines_ctx_t)))) {
+    if (map) { munmap(map, (size_t)st.st_size); }
+    return NULL;
+  }
+  lctx = mit->ctx;
+  lctx->map = map;
+  lctx->size = (size_t)st.st_size;
+  lctx->delim = (unsigned char)delim;
+  mit->kind = _MIT_KIND_LINES;
+  mit->nextsizedfn = _mit_lines_next;
+  mit->batchsizedfn = _mit_lines_next_batch;
+  mit->skipfn = _mit_lines_skip;
+  mit->freefn = _mit_lines_free;
+  mit->finite = 1;
+  mit->sized = 1;
+  return mit;
+
+error:
+  err = errno;
+  close(fd);
+  errno = err;
+  return NULL;
+}
+
+/* records are read in large blocks into a buffer owned by the iterator and
+ * returned as views into it.  A record cut off by the end of a block is
+ * moved to the front of the buffer before the next read, which is only done
+ * once every value handed out has been invalidated; the buffer only grows
+ * when a single record does not fit. */
+
+#define _MIT_FD_BUFSIZE ((size_t)64 << 10)
+
+struct _mit_fd_ctx_t {
+  unsigned char *buf;
+  size_t size;
+  size_t start;       /* first byte not yet returned */
+  size_t end;         /* end of buffered input */
+  size_t scanned;     /* bytes after start known not to hold a delimiter */
+  int fd;
+  int delim;
+  int eof;
+};
+
+static void _mit_fd_free(void *ctx) {
+  struct _mit_fd_ctx_t *fctx = ctx;
+  _mit_dealloc(fctx->buf);
+}
+
+/* returns 1 if a record was found, 0 at the end of input, -1 on error, and
+ * -2 if a non-blocking descriptor has no input yet; input is only read if
+ * fill is true, otherwise 0 is also returned when no complete record is
+ * buffered */
+static int _mit_fd_record(struct _mit_fd_ctx_t *fctx,
+    void **record, size_t *len, int fill) {
+  for (;;) {
+    unsigned char *start = fctx->buf + fctx->start, *end;
+    size_t avail = fctx->end - fctx->start;
+    ssize_t r;
+
+    end = memchr(start + fctx->scanned, fctx->delim, avail - fctx->scanned);
+    if (end != NULL || (fctx->eof && avail > 0)) {
+      *record = start;
+      *len = end ? (size_t)(end - start) : avail;
+      fctx->start += end ? *len + 1 : avail;
+      fctx->scanned = 0;
+      return 1;
+    }
+    fctx->scanned = avail;
+    if (fctx->eof || !fill) { return 0; }
+
+    if (fctx->start > 0) {
+      memmove(fctx->buf, start, avail);
+      fctx->start = 0;
+      fctx->end = avail;
+    }
+    if (fctx->end == fctx->size) {
+      unsigned char *buf = _mit_reallocfn(fctx->buf, fctx->size * 2);
+      if (buf == NULL) { return -1; }
+      fctx->buf = buf;
+      fctx->size *= 2;
+    }
+    do {
+      r = read(fctx->fd, fctx->buf + fctx->end, fctx->size - fctx->end);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) { return errno == EAGAIN || errno == EWOULDBLOCK ? -2 : -1; }
+    if (r == 0) { fctx->eof = 1; }
+    fctx->end += (size_t)r;
+  }
+}
+
+static mit_status_t _mit_fd_next(void *ctx, void **result, size_t *len) {
+  switch (_mit_fd_record(ctx, result, len, 1)) {
+    case 1:
+      return MIT_OK;
+    case 0:
+      return MIT_EXHAUSTED;
+    case -2:
+      return MIT_PENDING;
+    default:
+      return MIT_ERROR;
+  }
+}
+
+static mit_status_t _mit_fd_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  size_t i = 0, len;
+  int found = 0;
+  /* only the first record may read; reading moves the buffered input and
+   * would invalidate records already in the batch */
+  while (i < n && (found = _mit_fd_record(ctx,
+                  &values[i], lens ? &lens[i] : &len, i == 0)) > 0) {
+    i++;
+  }
+  *count = i;
+  if (i == 0) {
+    return found == -2 ? MIT_PENDING : found < 0 ? MIT_ERROR : MIT_EXHAUSTED;
+  }
+  return MIT_OK;
+}
+
+static mit_status_t _mit_fd_skip(void *ctx, size_t n, size_t *skipped) {
+  void *record;
+  size_t i = 0, len;
+  int found = 1;
+  while (i < n && (found = _mit_fd_record(ctx, &record, &len, 1)) > 0) { i++; }
+  *skipped = i;
+  if (found == -2) { return MIT_PENDING; }
+  if (found < 0) { return MIT_ERROR; }
+  return i == n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static int _mit_fd_fd(void *ctx) {
+  struct _mit_fd_ctx_t *fctx = ctx;
+  return fctx->fd;
+}
+
+mit_t *mit_from_fd(int fd, int delim, size_t bufsize) {
+  struct _mit_fd_ctx_t *fctx;
+  mit_t *mit;
+  if (bufsize == 0) { bufsize = _MIT_FD_BUFSIZE; }
+  if (!(mit = _mit_node_new(NULL, sizeof(struct _mit_fd_ctx_t)))) {
+    return NULL;
+  }
+  fctx = mit->ctx;
+  if ((fctx->buf = _mit_malloc(bufsize)) == NULL) {
+    mit_free(mit);
+    return NULL;
+  }
+  fctx->size = bufsize;
+  fctx->fd = fd;
+  fctx->delim = (unsigned char)delim;
+  mit->kind = _MIT_KIND_FD;
+  mit->nextsizedfn = _mit_fd_next;
+  mit->batchsizedfn = _mit_fd_next_batch;
+  mit->skipfn = _mit_fd_skip;
+  mit->fdfn = _mit_fd_fd;
+  mit->freefn = _mit_fd_free;
+  mit->finite = 1;
+  mit->sized = 1;
+  return mit;
+}
+
+#ifdef __linux__
+
+/**************
+ * event loop *
+ *************/
+
+/* pipelines are pulled until they report MIT_PENDING, at which point the
+ * descriptor they are waiting on is armed in an epoll set as a one-shot
+ * event.  Ready pipelines are serviced round-robin with a limit on the values
+ * pulled per turn, so a pipeline that never blocks cannot starve the rest. */
+
+#define _MIT_LOOP_BUDGET 64
+#define _MIT_LOOP_EVENTS 64
+
+struct _mit_loop_entry_t {
+  struct _mit_loop_entry_t *next;   /* run queue */
+  struct _mit_loop_entry_t *prev_entry, *next_entry;
+  mit_t *mit;
+  mit_loop_fn_t fn;
+  void *ctx;
+  int fd;             /* descriptor registered with epoll, or -1 */
+};
+
+struct mit_loop_t {
+  int epfd;
+  struct _mit_loop_entry_t *entries;
+  struct _mit_loop_entry_t *ready;
+  struct _mit_loop_entry_t **ready_tail;
+};
+
+mit_loop_t *mit_loop_new(void) {
+  mit_loop_t *loop = _mit_malloc(sizeof(mit_loop_t));
+  if (loop == NULL) { return NULL; }
+  if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+    _mit_dealloc(loop);
+    return NULL;
+  }
+  loop->entries = NULL;
+  loop->ready = NULL;
+  loop->ready_tail = &loop->ready;
+  return loop;
+}
+
+static void _mit_loop_queue(mit_loop_t *loop, struct _mit_loop_entry_t *e) {
+  e->next = NULL;
+  *loop->ready_tail = e;
+  loop->ready_tail = &e->next;
+}
+
+int mit_loop_add(mit_loop_t *loop, mit_t *mit, mit_loop_fn_t fn, void *ctx) {
+  struct _mit_loop_entry_t *e = _mit_malloc(sizeof(*e));
+  if (e == NULL) { return -1; }
+  e->mit = mit;
+  e->fn = fn;
+  e->ctx = ctx;
+  e->fd = -1;
+  e->prev_entry = NULL;
+  if ((e->next_entry = loop->entries) != NULL) {
+    e->next_entry->prev_entry = e;
+  }
+  loop->entries = e;
+  _mit_loop_queue(loop, e);
+  return 0;
+}
+
+static void _mit_loop_finish(mit_loop_t *loop, struct _mit_loop_entry_t *e) {
+  if (e->fd >= 0) { epoll_ctl(loop->epfd, EPOLL_CTL_DEL, e->fd, NULL); }
+  if (e->prev_entry) {
+    e->prev_entry->next_entry = e->next_entry;
+  } else {
+    loop->entries = e->next_entry;
+  }
+  if (e->next_entry) { e->next_entry->prev_entry = e->prev_entry; }
+  mit_free(e->mit);
+  _mit_dealloc(e);
+}
+
+/* arm the descriptor a pending pipeline is waiting on; returns -1 if there
+ * is nothing to wait for */
+static int _mit_loop_wait(mit_loop_t *loop, struct _mit_loop_entry_t *e) {
+  struct epoll_event ev;
+  int fd = mit_pending_fd(e->mit), op = EPOLL_CTL_ADD;
+  if (fd < 0) { return -1; }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.ptr = e;
+  if (fd == e->fd) {
+    op = EPOLL_CTL_MOD;
+  } else if (e->fd >= 0) {
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, e->fd, NULL);
+    e->fd = -1;
+  }
+  if (epoll_ctl(loop->epfd, op, fd, &ev) != 0) { return -1; }
+  e->fd = fd;
+  return 0;
+}
+
+static void _mit_loop_service(mit_loop_t *loop, struct _mit_loop_entry_t *e) {
+  mit_result_t *res, failed;
+  size_t i;
+  for (i = 0; i < _MIT_LOOP_BUDGET; i++) {
+    switch ((res = mit_next(e->mit))->status) {
+      case MIT_OK:
+        if (e->fn(e->mit, res, e->ctx) != 0) {
+          _mit_loop_finish(loop, e);
+          return;
+        }
+        break;
+      case MIT_PENDING:
+        if (_mit_loop_wait(loop, e) == 0) { return; }
+        /* a pipeline that cannot be woken up would never finish */
+        failed.status = MIT_ERROR;
+        failed.value = NULL;
+        failed.len = 0;
+        e->fn(e->mit, &failed, e->ctx);
+        _mit_loop_finish(loop, e);
+        return;
+      default:
+        e->fn(e->mit, res, e->ctx);
+        _mit_loop_finish(loop, e);
+        return;
+    }
+  }
+  _mit_loop_queue(loop, e);
+}
+
+int mit_loop_run(mit_loop_t *loop) {
+  struct epoll_event events[_MIT_LOOP_EVENTS];
+  while (loop->entries) {
+    struct _mit_loop_entry_t *e = loop->ready;
+    int n, i;
+    /* pipelines requeued during this pass wait for the next one */
+    loop->ready = NULL;
+    loop->ready_tail = &loop->ready;
+    while (e) {
+      struct _mit_loop_entry_t *next = e->next;
+      _mit_loop_service(loop, e);
+      e = next;
+    }
+    if (loop->entries == NULL) { break; }
+    n = epoll_wait(loop->epfd, events, _MIT_LOOP_EVENTS,
+            loop->ready ? 0 : -1);
+    if (n < 0 && errno != EINTR) { return -1; }
+    for (i = 0; i < n; i++) { _mit_loop_queue(loop, events[i].data.ptr); }
+  }
+  return 0;
+}
+
+void mit_loop_free(mit_loop_t *loop) {
+  if (loop) {
+    while (loop->entries) { _mit_loop_finish(loop, loop->entries); }
+    close(loop->epfd);
+    _mit_dealloc(loop);
+  }
+}
+
+#endif /* __linux__ */
+
+#endif /* MIT_POSIX */
+
+#ifdef MIT_UCONTEXT
+
+/*******************
+ * fiber iterators *
+ ******************/
+
+/* the producer runs on a stack of its own and switches back to the consumer
+ * at every yield, so it can keep its state in locals and recurse freely */
+
+#define _MIT_FIBER_STACK ((size_t)64 << 10)
+
+struct mit_fiber_t {
+  ucontext_t caller;
+  ucontext_t fiber;
+  mit_fiber_fn_t fn;
+  void *ctx;
+  mit_free_fn_t freefn;
+  void *value;
+  mit_status_t status;  /* MIT_OK until the producer returns */
+  int started;
+  int stop;             /* the iterator is being freed */
+  unsigned char *stack;
+};
+
+/* makecontext only passes ints, so the pointer is split in two halves */
+static void _mit_fiber_main(unsigned int hi, unsigned int lo) {
+  mit_fiber_t *fiber = (mit_fiber_t *)(((uintptr_t)hi << 16 << 16) | lo);
+  mit_status_t status = fiber->fn(fiber, fiber->ctx);
+  fiber->status = status == MIT_ERROR ? MIT_ERROR : MIT_EXHAUSTED;
+  /* returning resumes the consumer through uc_link */
+}
+
+static mit_status_t _mit_fiber_next(void *ctx, void **result) {
+  mit_fiber_t *fiber = ctx;
+  fiber->started = 1;
+  swapcontext(&fiber->caller, &fiber->fiber);
+  if (fiber->status != MIT_OK) { return fiber->status; }
+  *result = fiber->value;
+  return MIT_OK;
+}
+
+static void _mit_fiber_free(void *ctx) {
+  mit_fiber_t *fiber = ctx;
+  if (fiber->started) {
+    /* let the producer see the stop request and release what it holds */
+    fiber->stop = 1;
+    while (fiber->status == MIT_OK) {
+      swapcontext(&fiber->caller, &fiber->fiber);
+    }
+  }
+  if (fiber->freefn) { fiber->freefn(fiber->ctx); }
+  _mit_dealloc(fiber->stack);
+}
+
+int mit_fiber_yield(mit_fiber_t *fiber, void *value) {
+  if (fiber->stop) { return 0; }
+  fiber->value = value;
+  swapcontext(&fiber->fiber, &fiber->caller);
+  return !fiber->stop;
+}
+
+/* kept apart from mit_fiber_new so no other locals are live across
+ * getcontext, which returns twice */
+static int _mit_fiber_prepare(mit_fiber_t *fiber, size_t stacksize) {
+  uintptr_t addr = (uintptr_t)fiber;
+  if (getcontext(&fiber->fiber) != 0) { return -1; }
+  fiber->fiber.uc_stack.ss_sp = fiber->stack;
+  fiber->fiber.uc_stack.ss_size = stacksize;
+  fiber->fiber.uc_link = &fiber->caller;
+  makecontext(&fiber->fiber, (void (*)(void))_mit_fiber_main, 2,
+      (unsigned int)(addr >> 16 >> 16), (unsigned int)(addr & 0xffffffffu));
+  return 0;
+}
+
+mit_t *mit_fiber_new(mit_fiber_fn_t fn, void *ctx, mit_free_fn_t freefn,
+    size_t stacksize) {
+  mit_fiber_t *fiber;
+  mit_t *mit;
+  if (stacksize == 0) { stacksize = _MIT_FIBER_STACK; }
+  if (!(mit = _mit_node_new(NULL, sizeof(mit_fiber_t)))) { return NULL; }
+  fiber = mit->ctx;
+  if ((fiber->stack = _mit_malloc(stacksize)) == NULL) {
+    mit_free(mit);
+    return NULL;
+  }
+  if (_mit_fiber_prepare(fiber, stacksize) != 0) {
+    _mit_dealloc(fiber->stack);
+    mit_free(mit);
+    return NULL;
+  }
+  fiber->fn = fn;
+  fiber->ctx = ctx;
+  fiber->freefn = freefn;
+  mit->nextfn = _mit_fiber_next;
+  mit->freefn = _mit_fiber_free;
+  return mit;
+}
+
+#endif /* MIT_UCONTEXT */
+
+#ifdef MIT_THREADS
+
+/*********************
+ * prefetch iterator *
+ ********************/
+
+/* a background thread drains the wrapped iterator into a single-producer,
+ * single-consumer ring; each side only sleeps when the ring is empty or full
+ * and announces it with a flag the other side checks after publishing.
+ * While the wrapped iterator is pending and the ring is empty the consumer
+ * does not sleep but reports MIT_PENDING, arming a pipe the producer writes
+ * to once it publishes, so an event loop can wait for the prefetch. */
+
+#define _MIT_PREFETCH_CONSUMER 1
+#define _MIT_PREFETCH_PRODUCER 2
+#define _MIT_PREFETCH_NOTIFY 4
+
+struct _mit_prefetch_ctx_t {
+  mit_t *mit;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t mask;
+  int stop;
+  int joined;         /* the thread has been stopped */
+  int waiting;
+  int pending;        /* the producer is waiting for a pending source */
+  int notify[2];      /* pipe written for an armed consumer, or -1 */
+  unsigned char pad1[_MIT_CACHE_LINE];
+  size_t head;        /* next slot to read, written by the consumer */
+  unsigned char pad2[_MIT_CACHE_LINE];
+  size_t tail;        /* next slot to write, written by the producer */
+  unsigned char pad3[_MIT_CACHE_LINE];
+  mit_result_t ring[];
+};
+
+#define _mit_load(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+#define _mit_store(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_SEQ_CST)
+
+/* block until ready() is true for the calling side */
+static void _mit_prefetch_wait(struct _mit_prefetch_ctx_t *pctx, int who,
+    int (*ready)(struct _mit_prefetch_ctx_t *)) {
+  pthread_mutex_lock(&pctx->lock);
+  __atomic_or_fetch(&pctx->waiting, who, __ATOMIC_SEQ_CST);
+  while (!ready(pctx)) {
+    pthread_cond_wait(&pctx->cond, &pctx->lock);
+  }
+  __atomic_and_fetch(&pctx->waiting, ~who, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&pctx->lock);
+}
+
+static void _mit_prefetch_wake(struct _mit_prefetch_ctx_t *pctx, int who) {
+  int waiting = _mit_load(&pctx->waiting);
+  if (waiting & who) {
+    pthread_mutex_lock(&pctx->lock);
+    pthread_cond_broadcast(&pctx->cond);
+    pthread_mutex_unlock(&pctx->lock);
+  }
+#ifdef MIT_POSIX
+  if (who == _MIT_PREFETCH_CONSUMER && (waiting & _MIT_PREFETCH_NOTIFY)) {
+    /* a full pipe is readable already, so a failed write is harmless */
+    ssize_t written = write(pctx->notify[1], "", 1);
+    (void)written;
+  }
+#endif
+}
+
+static int _mit_prefetch_readable(struct _mit_prefetch_ctx_t *pctx) {
+  return _mit_load(&pctx->tail) != pctx->head;
+}
+
+static int _mit_prefetch_available(struct _mit_prefetch_ctx_t *pctx) {
+  return _mit_prefetch_readable(pctx) || _mit_load(&pctx->pending);
+}
+
+/* ask the producer to write to the pipe once it publishes; returns -1 if
+ * values are ready after all or there is no pipe to wait on */
+static int _mit_prefetch_arm(struct _mit_prefetch_ctx_t *pctx) {
+#ifdef MIT_POSIX
+  if (pctx->notify[0] < 0) {
+    if (pipe(pctx->notify) != 0) {
+      pctx->notify[0] = pctx->notify[1] = -1;
+      return -1;
+    }
+    fcntl(pctx->notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(pctx->notify[1], F_SETFL, O_NONBLOCK);
+  }
+  __atomic_or_fetch(&pctx->waiting, _MIT_PREFETCH_NOTIFY, __ATOMIC_SEQ_CST);
+  if (!_mit_prefetch_readable(pctx)) { return 0; }
+  __atomic_and_fetch(&pctx->waiting, ~_MIT_PREFETCH_NOTIFY, __ATOMIC_SEQ_CST);
+#else
+  (void)pctx;
+#endif
+  return -1;
+}
+
+static void _mit_prefetch_disarm(struct _mit_prefetch_ctx_t *pctx) {
+#ifdef MIT_POSIX
+  char buf[64];
+  if (!(_mit_load(&pctx->waiting) & _MIT_PREFETCH_NOTIFY)) { return; }
+  __atomic_and_fetch(&pctx->waiting, ~_MIT_PREFETCH_NOTIFY, __ATOMIC_SEQ_CST);
+  while (read(pctx->notify[0], buf, sizeof(buf)) > 0);
+#else
+  (void)pctx;
+#endif
+}
+
+static int _mit_prefetch_writable(struct _mit_prefetch_ctx_t *pctx) {
+  return _mit_load(&pctx->stop)
+      || pctx->tail - _mit_load(&pctx->head) <= pctx->mask;
+}
+
+/* the producer thread is free to block on a pending source; the timeout
+ * bounds how long it takes to notice a stop request */
+static void _mit_prefetch_block(mit_t *mit) {
+#ifdef MIT_POSIX
+  struct pollfd pfd;
+  if ((pfd.fd = mit_pending_fd(mit)) >= 0) {
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 10);
+  }
+#else
+  (void)mit;
+#endif
+}
+
+static void *_mit_prefetch_run(void *ctx) {
+  struct _mit_prefetch_ctx_t *pctx = ctx;
+  mit_result_t *res;
+  do {
+    if (!_mit_prefetch_writable(pctx)) {
+      _mit_prefetch_wait(pctx, _MIT_PREFETCH_PRODUCER, _mit_prefetch_writable);
+    }
+    if (_mit_load(&pctx->stop)) { break; }
+    if ((res = mit_next(pctx->mit))->status == MIT_PENDING) {
+      if (!pctx->pending) {
+        _mit_store(&pctx->pending, 1);
+        _mit_prefetch_wake(pctx, _MIT_PREFETCH_CONSUMER);
+      }
+      _mit_prefetch_block(pctx->mit);
+      continue;
+    }
+    if (pctx->pending) { _mit_store(&pctx->pending, 0); }
+    pctx->ring[pctx->tail & pctx->mask] = *res;
+    _mit_store(&pctx->tail, pctx->tail + 1);
+    _mit_prefetch_wake(pctx, _MIT_PREFETCH_CONSUMER);
+  } while (res->status == MIT_OK || res->status == MIT_PENDING);
+  return NULL;
+}
+
+static void _mit_prefetch_stop(struct _mit_prefetch_ctx_t *pctx) {
+  if (pctx->joined) { return; }
+  _mit_store(&pctx->stop, 1);
+  pthread_mutex_lock(&pctx->lock);
+  pthread_cond_broadcast(&pctx->cond);
+  pthread_mutex_unlock(&pctx->lock);
+  pthread_join(pctx->thread, NULL);
+  pctx->joined = 1;
+}
+
+static void _mit_prefetch_free(struct _mit_prefetch_ctx_t *pctx) {
+  _mit_prefetch_stop(pctx);
+  pthread_cond_destroy(&pctx->cond);
+  pthread_mutex_destroy(&pctx->lock);
+#ifdef MIT_POSIX
+  if (pctx->notify[0] >= 0) {
+    close(pctx->notify[0]);
+    close(pctx->notify[1]);
+  }
+#endif
+  mit_free(pctx->mit);
+}
+
+static mit_status_t _mit_prefetch_next_batch(void *ctx,
+    void **values, size_t *lens, size_t n, size_t *count) {
+  struct _mit_prefetch_ctx_t *pctx = ctx;
+  mit_status_t status = MIT_OK;
+  size_t avail, i;
+
+  _mit_prefetch_disarm(pctx);
+  if (!_mit_prefetch_readable(pctx)) {
+    _mit_prefetch_wait(pctx, _MIT_PREFETCH_CONSUMER, _mit_prefetch_available);
+    if (!_mit_prefetch_readable(pctx)) {
+      if (_mit_prefetch_arm(pctx) == 0) {
+        *count = 0;
+        return MIT_PENDING;
+      }
+      _mit_prefetch_wait(pctx, _MIT_PREFETCH_CONSUMER,
+          _mit_prefetch_readable);
+    }
+  }
+  avail = _mit_load(&pctx->tail) - pctx->head;
+  for (i = 0; i < avail && i < n; i++) {
+    mit_result_t *res = &pctx->ring[(pctx->head + i) & pctx->mask];
+    if ((status = res->status) != MIT_OK) {
+      break;
+    }
+    values[i] = res->value;
+    if (lens) { lens[i] = res->len; }
+  }
+  *count = i;
+  _mit_store(&pctx->head, pctx->head + i + (status != MIT_OK));
+  _mit_prefetch_wake(pctx, _MIT_PREFETCH_PRODUCER);
+  return status;
+}
+
+static mit_status_t _mit_prefetch_next(void *ctx, void **result, size_t *len) {
+  size_t count;
+  return _mit_prefetch_next_batch(ctx, result, len, 1, &count);
+}
+
+static int _mit_prefetch_fd(void *ctx) {
+  struct _mit_prefetch_ctx_t *pctx = ctx;
+  return pctx->notify[0];
+}
+
+mit_t *mit_prefetch(mit_t *mit, size_t depth) {
+  struct _mit_prefetch_ctx_t *pctx;
+  size_t size = 2;
+  mit_t *new;
+
+  while (size < depth) { size *= 2; }
+  if (!(new = _mit_node_new(mit->arena, sizeof(struct _mit_prefetch_ctx_t)
+              + size * sizeof(mit_result_t)))) {
+    return NULL;
+  }
+  pctx = new->ctx;
+  pctx->mit = mit;
+  pctx->mask = size - 1;
+  pctx->notify[0] = pctx->notify[1] = -1;
+  new->kind = _MIT_KIND_PREFETCH;
+  new->nextsizedfn = _mit_prefetch_next;
+  new->batchsizedfn = _mit_prefetch_next_batch;
+  new->fdfn = _mit_prefetch_fd;
+  new->finite = mit->finite;
+  new->sized = mit->sized;
+
+  if (pthread_mutex_init(&pctx->lock, NULL) != 0) {
+    mit_free(new);
+    return NULL;
+  }
+  if (pthread_cond_init(&pctx->cond, NULL) != 0) {
+    pthread_mutex_destroy(&pctx->lock);
+    mit_free(new);
+    return NULL;
+  }
+  if (pthread_create(&pctx->thread, NULL, _mit_prefetch_run, pctx) != 0) {
+    pthread_cond_destroy(&pctx->cond);
+    pthread_mutex_destroy(&pctx->lock);
+    mit_free(new);
+    return NULL;
+  }
+  new->freefn = (mit_free_fn_t) _mit_prefetch_free;
+
+  return new;
+}
+
+/*************************
+ * parallel map iterator *
+ ************************/
+
+/* the consumer pulls chunks from the wrapped iterator and hands them to a
+ * pool of workers, each with its own deque; idle workers steal from the
+ * back of other deques.  In ordered mode finished chunks wait in a reorder
+ * buffer indexed by sequence number until every earlier chunk has been
+ * returned. */
+
+#define _MIT_PAR_CHUNK 64
+
+struct _mit_par_chunk_t {
+  struct _mit_par_chunk_t *next;  /* free list or finished queue */
+  size_t seq;
+  size_t n;           /* values retrieved from the source */
+  size_t mapped;      /* values mapped before an error */
+  int done;
+  void *values[_MIT_PAR_CHUNK];
+};
+
+struct _mit_par_worker_t {
+  struct _mit_par_ctx_t *par;
+  size_t id;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  size_t head;        /* owner takes the oldest task */
+  size_t tail;        /* thieves take the newest */
+  struct _mit_par_chunk_t **tasks;
+};
+
+struct _mit_par_ctx_t {
+  mit_t *mit;
+  mit_map_fn_t mapfn;
+  void *ctx;
+  int ordered;
+
+  size_t nthreads;
+  struct _mit_par_worker_t *workers;
+  size_t nchunks;
+  struct _mit_par_chunk_t *chunks;
+  struct _mit_par_chunk_t **reorder;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  size_t pending;     /* queued tasks not yet claimed by a worker */
+  int stop;
+  struct _mit_par_chunk_t *finished;
+  struct _mit_par_chunk_t **finished_tail;
+
+  /* only used by the consumer */
+  struct _mit_par_chunk_t *free;
+  struct _mit_par_chunk_t *current;
+  size_t pos;
+  size_t submitted;
+  size_t delivered;
+  mit_status_t src_status;
+};
+
+static struct _mit_par_chunk_t *_mit_par_take(struct _mit_par_ctx_t *par,
+    size_t id) {
+  size_t i;
+  for (i = 0;; i++) {
+    struct _mit_par_worker_t *w = &par->workers[(id + i) % par->nthreads];
+    struct _mit_par_chunk_t *chunk = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->head != w->tail) {
+      chunk = (i % par->nthreads) == 0
+          ? w->tasks[w->head++ % par->nchunks]
+          : w->tasks[--w->tail % par->nchunks];
+    }
+    pthread_mutex_unlock(&w->lock);
+    if (chunk) { return chunk; }
+  }
+}
+
+static void *_mit_par_run(void *arg) {
+  struct _mit_par_worker_t *w = arg;
+  struct _mit_par_ctx_t *par = w->par;
+  for (;;) {
+    struct _mit_par_chunk_t *chunk;
+    size_t i;
+
+    pthread_mutex_lock(&par->lock);
+    while (par->pending == 0 && !par->stop) {
+      pthread_cond_wait(&par->work, &par->lock);
+    }
+    if (par->stop) {
+      pthread_mutex_unlock(&par->lock);
+      return NULL;
+    }
+    par->pending--;
+    pthread_mutex_unlock(&par->lock);
+
+    /* a claimed task is guaranteed to be in one of the deques */
+    chunk = _mit_par_take(par, w->id);
+    for (i = 0; i < chunk->n; i++) {
+      if (par->mapfn(chunk->values[i], par->ctx, &chunk->values[i]) != MIT_OK) {
+        break;
+      }
+    }
+    chunk->mapped = i;
+
+    pthread_mutex_lock(&par->lock);
+    chunk->done = 1;
+    if (!par->ordered) {
+      chunk->next = NULL;
+      *par->finished_tail = chunk;
+      par->finished_tail = &chunk->next;
+    }
+    pthread_cond_signal(&par->done);
+    pthread_mutex_unlock(&par->lock);
+  }
+}
 
-  if (!(cctx = calloc(1, sizeof(struct _mit_chain_ctx_t)))) { return NULL; }
-  if (!(new = mit_new(_mit_chain_next, cctx, (mit_free_fn_t) _mit_chain_free))) {
-    _mit_chain_free(cctx);
+static void _mit_par_submit(struct _mit_par_ctx_t *par) {
+  struct _mit_par_chunk_t *chunk = par->free;
+  struct _mit_par_worker_t *w;
+  size_t got;
+
+  chunk->n = 0;
+  while (chunk->n < _MIT_PAR_CHUNK && (got = mit_next_batch(par->mit,
+              chunk->values + chunk->n, _MIT_PAR_CHUNK - chunk->n)) > 0) {
+    chunk->n += got;
+  }
+  if (!_mit_is_live(par->mit)) { par->src_status = mit_status(par->mit); }
+  if (chunk->n == 0) { return; }
+
+  par->free = chunk->next;
+  chunk->seq = par->submitted++;
+  chunk->done = 0;
+  if (par->ordered) { par->reorder[chunk->seq % par->nchunks] = chunk; }
+
+  w = &par->workers[chunk->seq % par->nthreads];
+  pthread_mutex_lock(&w->lock);
+  w->tasks[w->tail++ % par->nchunks] = chunk;
+  pthread_mutex_unlock(&w->lock);
+
+  pthread_mutex_lock(&par->lock);
+  par->pending++;
+  pthread_cond_signal(&par->work);
+  pthread_mutex_unlock(&par->lock);
+}
+
+static mit_status_t _mit_par_next_batch(void *ctx,
+    void **values, size_t n, size_t *count) {
+  struct _mit_par_ctx_t *par = ctx;
+  struct _mit_par_chunk_t *cur;
+
+  *count = 0;
+  while ((cur = par->current) == NULL || par->pos == cur->mapped) {
+    if (cur) {
+      if (cur->mapped < cur->n) { return MIT_ERROR; }
+      cur->next = par->free;
+      par->free = cur;
+      par->current = NULL;
+    }
+
+    /* keep the workers busy */
+    while (par->src_status == MIT_OK && par->free) {
+      _mit_par_submit(par);
+      if (mit_is_pending(par->mit)) { break; }
+    }
+    if (par->delivered == par->submitted) {
+      return mit_is_pending(par->mit) ? MIT_PENDING : par->src_status;
+    }
+
+    pthread_mutex_lock(&par->lock);
+    if (par->ordered) {
+      cur = par->reorder[par->delivered % par->nchunks];
+      while (!cur->done) { pthread_cond_wait(&par->done, &par->lock); }
+    } else {
+      while (!par->finished) { pthread_cond_wait(&par->done, &par->lock); }
+      cur = par->finished;
+      if ((par->finished = cur->next) == NULL) {
+        par->finished_tail = &par->finished;
+      }
+    }
+    pthread_mutex_unlock(&par->lock);
+    par->delivered++;
+    par->current = cur;
+    par->pos = 0;
+  }
+
+  while (*count < n && par->pos < cur->mapped) {
+    values[(*count)++] = cur->values[par->pos++];
+  }
+  return MIT_OK;
+}
+
+static mit_status_t _mit_par_next(void *ctx, void **result) {
+  size_t count;
+  return _mit_par_next_batch(ctx, result, 1, &count);
+}
+
+static int _mit_par_fd(void *ctx) {
+  struct _mit_par_ctx_t *par = ctx;
+  return mit_pending_fd(par->mit);
+}
+
+/* destroy the shared lock and conditions and the first nlocks worker
+ * locks */
+static void _mit_par_destroy(struct _mit_par_ctx_t *par, size_t nlocks) {
+  size_t i;
+  for (i = 0; i < nlocks; i++) {
+    pthread_mutex_destroy(&par->workers[i].lock);
+  }
+  pthread_cond_destroy(&par->done);
+  pthread_cond_destroy(&par->work);
+  pthread_mutex_destroy(&par->lock);
+}
+
+static void _mit_par_shutdown(struct _mit_par_ctx_t *par, size_t nstarted) {
+  size_t i;
+  pthread_mutex_lock(&par->lock);
+  par->stop = 1;
+  pthread_cond_broadcast(&par->work);
+  pthread_mutex_unlock(&par->lock);
+  for (i = 0; i < nstarted; i++) {
+    pthread_join(par->workers[i].thread, NULL);
+  }
+  _mit_par_destroy(par, par->nthreads);
+}
+
+static void _mit_par_free(struct _mit_par_ctx_t *par) {
+  _mit_par_shutdown(par, par->nthreads);
+  mit_free(par->mit);
+}
+
+mit_t *mit_par_map(mit_t *mit, mit_map_fn_t mapfn, void *ctx,
+    size_t nthreads, int ordered) {
+  struct _mit_par_ctx_t *par;
+  size_t nchunks, i, wsize, csize, rsize, tsize;
+  unsigned char *mem;
+  mit_t *new;
+
+  if (nthreads == 0) { nthreads = 1; }
+  nchunks = 2 * nthreads + 1;
+  wsize = _MIT_ROUND_UP(sizeof(struct _mit_par_ctx_t), _MIT_ALIGNMENT);
+  csize = _MIT_ROUND_UP(nthreads * sizeof(struct _mit_par_worker_t),
+          _MIT_ALIGNMENT);
+  rsize = nchunks * sizeof(struct _mit_par_chunk_t);
+  tsize = nchunks * sizeof(struct _mit_par_chunk_t *);
+
+  if (!(new = _mit_node_new(mit->arena,
+              wsize + csize + rsize + tsize * (nthreads + 1)))) {
     return NULL;
   }
+  par = new->ctx;
+  mem = new->ctx;
+  par->workers = (struct _mit_par_worker_t *)(mem + wsize);
+  par->chunks = (struct _mit_par_chunk_t *)(mem + wsize + csize);
+  par->reorder = (struct _mit_par_chunk_t **)(mem + wsize + csize + rsize);
+  par->mit = mit;
+  par->mapfn = mapfn;
+  par->ctx = ctx;
+  par->ordered = ordered;
+  par->nthreads = nthreads;
+  par->nchunks = nchunks;
+  par->finished_tail = &par->finished;
+  par->src_status = MIT_OK;
+  for (i = 0; i < nchunks; i++) {
+    par->chunks[i].next = par->free;
+    par->free = &par->chunks[i];
+  }
 
-  cctx->mit1 = mit1;
-  cctx->mit2 = mit2;
+  if (pthread_mutex_init(&par->lock, NULL) != 0) {
+    mit_free(new);
+    return NULL;
+  }
+  if (pthread_cond_init(&par->work, NULL) != 0) {
+    pthread_mutex_destroy(&par->lock);
+    mit_free(new);
+    return NULL;
+  }
+  if (pthread_cond_init(&par->done, NULL) != 0) {
+    pthread_cond_destroy(&par->work);
+    pthread_mutex_destroy(&par->lock);
+    mit_free(new);
+    return NULL;
+  }
+  for (i = 0; i < nthreads; i++) {
+    struct _mit_par_worker_t *w = &par->workers[i];
+    w->par = par;
+    w->id = i;
+    w->tasks = par->reorder + nchunks * (i + 1);
+    if (pthread_mutex_init(&w->lock, NULL) != 0) {
+      _mit_par_destroy(par, i);
+      mit_free(new);
+      return NULL;
+    }
+  }
+  for (i = 0; i < nthreads; i++) {
+    struct _mit_par_worker_t *w = &par->workers[i];
+    if (pthread_create(&w->thread, NULL, _mit_par_run, w) != 0) {
+      _mit_par_shutdown(par, i);
+      mit_free(new);
+      return NULL;
+    }
+  }
 
-  new->finite = mit1->finite && mit2->finite;
+  new->kind = _MIT_KIND_PAR;
+  new->nextfn = _mit_par_next;
+  new->batchfn = _mit_par_next_batch;
+  new->fdfn = _mit_par_fd;
+  new->freefn = (mit_free_fn_t) _mit_par_free;
+  new->finite = mit->finite;
 
   return new;
 }
 
+#endif /* MIT_THREADS */
+
+/*********
+ * stats *
+ ********/
+
+#ifdef MIT_STATS
+
+const mit_stats_t *mit_stats(mit_t *mit) {
+  return &mit->stats;
+}
+
+static void _mit_stats_dump(mit_t *mit, FILE *stream, int depth) {
+  const char *kind = "iterator";
+  mit_stats_t *st = &mit->stats;
+  size_t i;
+
+  if (mit->kind == _MIT_KIND_PIPE) {
+    kind = "grep/map";
+  } else if (mit->kind == _MIT_KIND_CHAIN) {
+    kind = "chain";
+  } else if (mit->kind == _MIT_KIND_TAKE) {
+    kind = "take";
+  } else if (mit->kind == _MIT_KIND_WINDOW) {
+    kind = "window";
+  } else if (mit->kind == _MIT_KIND_MERGE) {
+    kind = "merge";
+  } else if (mit->kind == _MIT_KIND_SORT) {
+    kind = "sort";
+  } else if (mit->kind == _MIT_KIND_GROUP) {
+    kind = "group";
+  } else if (mit->kind == _MIT_KIND_JOIN) {
+    kind = "join";
+#ifdef MIT_THREADS
+  } else if (mit->kind == _MIT_KIND_PREFETCH) {
+    kind = "prefetch";
+  } else if (mit->kind == _MIT_KIND_PAR) {
+    kind = "parallel map";
+#endif
+  }
+
+  fprintf(stream, "%*s%s: calls %llu batches %llu peek hits %llu"
+      " yielded %llu errors %llu cycles %llu\n", depth * 2, "", kind,
+      st->calls, st->batches, st->peek_hits, st->yielded, st->errors,
+      st->cycles);
+
+  if (mit->kind == _MIT_KIND_PIPE) {
+    struct _mit_pipe_ctx_t *pctx = mit->ctx;
+    for (i = 0; i < pctx->nstages; i++) {
+      struct _mit_stage_t *stage = &pctx->stages[i];
+      fprintf(stream, "%*sstage %zu %s: in %llu out %llu dropped %llu"
+          " selectivity %.1f%% cycles %llu\n", depth * 2 + 2, "", i,
+          _MIT_STAGE_IS_GREP(stage) ? "grep" : "map", stage->in, stage->out,
+          _MIT_STAGE_IS_GREP(stage) ? stage->in - stage->out : 0ULL,
+          stage->in ? 100.0 * stage->out / stage->in : 100.0, stage->cycles);
+    }
+    _mit_stats_dump(pctx->mit, stream, depth + 1);
+  } else if (mit->kind == _MIT_KIND_CHAIN) {
+    struct _mit_chain_ctx_t *cctx = mit->ctx;
+    for (i = cctx->pos; i < cctx->n; i++) {
+      _mit_stats_dump(cctx->mits[i], stream, depth + 1);
+    }
+  } else if (mit->kind == _MIT_KIND_TAKE) {
+    struct _mit_take_ctx_t *tctx = mit->ctx;
+    if (tctx->mit) { _mit_stats_dump(tctx->mit, stream, depth + 1); }
+  } else if (mit->kind == _MIT_KIND_WINDOW) {
+    struct _mit_window_ctx_t *w = mit->ctx;
+    _mit_stats_dump(w->mit, stream, depth + 1);
+  } else if (mit->kind == _MIT_KIND_MERGE) {
+    struct _mit_merge_ctx_t *m = mit->ctx;
+    for (i = 0; i < m->k; i++) {
+      if (m->mits[i]) { _mit_stats_dump(m->mits[i], stream, depth + 1); }
+    }
+  } else if (mit->kind == _MIT_KIND_SORT) {
+    struct _mit_sort_ctx_t *s = mit->ctx;
+    if (s->mit) { _mit_stats_dump(s->mit, stream, depth + 1); }
+    if (s->out) { _mit_stats_dump(s->out, stream, depth + 1); }
+  } else if (mit->kind == _MIT_KIND_GROUP) {
+    struct _mit_group_ctx_t *g = mit->ctx;
+    if (g->mit) { _mit_stats_dump(g->mit, stream, depth + 1); }
+  } else if (mit->kind == _MIT_KIND_JOIN) {
+    struct _mit_join_ctx_t *j = mit->ctx;
+    if (j->build) { _mit_stats_dump(j->build, stream, depth + 1); }
+    if (j->probe) { _mit_stats_dump(j->probe, stream, depth + 1); }
+#ifdef MIT_THREADS
+  } else if (mit->kind == _MIT_KIND_PREFETCH) {
+    struct _mit_prefetch_ctx_t *pctx = mit->ctx;
+    _mit_stats_dump(pctx->mit, stream, depth + 1);
+  } else if (mit->kind == _MIT_KIND_PAR) {
+    struct _mit_par_ctx_t *par = mit->ctx;
+    _mit_stats_dump(par->mit, stream, depth + 1);
+#endif
+  }
+}
+
+void mit_stats_dump(mit_t *mit, FILE *stream) {
+  _mit_stats_dump(mit, stream, 0);
+}
+
+#endif /* MIT_STATS */
+
 #endif /* MITERATOR_C */
 
 /* vim: set ts=2 sw=2 et: */
@@ -26,46 +26,248 @@
 #define MITERATOR_H
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 
+/* store integers such as those returned by mit_range in values */
+#define MIT_PTR(i) ((void *)(intptr_t)(i))
+#define MIT_INT(value) ((intptr_t)(value))
+
 typedef struct mit_t mit_t;
+typedef struct mit_arena_t mit_arena_t;
+#if defined(MIT_POSIX) && defined(__linux__)
+typedef struct mit_loop_t mit_loop_t;
+#endif
+#ifdef MIT_UCONTEXT
+typedef struct mit_fiber_t mit_fiber_t;
+#endif
+
+/* caller-provided memory for a single iterator, see mit_init */
+#ifdef MIT_STATS
+#define MIT_STORAGE_SIZE 256
+#else
+#define MIT_STORAGE_SIZE 192
+#endif
+
+typedef union mit_storage_t {
+  unsigned char bytes[MIT_STORAGE_SIZE];
+  long double ld;
+  long long ll;
+  void *p;
+} mit_storage_t;
 
 typedef enum mit_status_t {
   MIT_OK = 0,
   MIT_ERROR,
-  MIT_EXHAUSTED
+  MIT_EXHAUSTED,
+  MIT_PENDING         /* no value yet, wait for mit_pending_fd and retry */
 } mit_status_t;
 
 typedef struct mit_result_t {
   mit_status_t status;
   void *value;
+  size_t len;         /* length of value for sized iterators, otherwise 0 */
 } mit_result_t;
 
+/* groups and joins return pointers to pairs */
+typedef struct mit_pair_t {
+  void *first;
+  size_t firstlen;
+  void *second;
+  size_t secondlen;
+} mit_pair_t;
+
 typedef mit_status_t (*mit_next_fn_t)(void *ctx, void **result);
+typedef mit_status_t (*mit_batch_fn_t)(void *ctx, void **values, size_t n,
+    size_t *count);
+typedef mit_status_t (*mit_next_sized_fn_t)(void *ctx, void **result,
+    size_t *len);
+typedef mit_status_t (*mit_batch_sized_fn_t)(void *ctx, void **values,
+    size_t *lens, size_t n, size_t *count);
+typedef mit_status_t (*mit_skip_fn_t)(void *ctx, size_t n, size_t *skipped);
+typedef int          (*mit_size_fn_t)(void *ctx, size_t *remaining);
+typedef int          (*mit_fd_fn_t)(void *ctx);
 typedef mit_status_t (*mit_grep_fn_t)(void *value, void *ctx, int *matches);
 typedef mit_status_t (*mit_map_fn_t)(void *value, void *ctx, void **result);
+typedef mit_status_t (*mit_grep_sized_fn_t)(void *value, size_t len,
+    void *ctx, int *matches);
+typedef mit_status_t (*mit_map_sized_fn_t)(void *value, size_t len,
+    void *ctx, void **result, size_t *rlen);
+typedef mit_status_t (*mit_grep_batch_fn_t)(void **values, size_t n,
+    void *ctx, unsigned char *selected);
+typedef mit_status_t (*mit_fold_fn_t)(void *acc, void *value, size_t len,
+    void *ctx, void **result);
+typedef mit_status_t (*mit_init_fn_t)(void *key, size_t keylen,
+    void *ctx, void **result);
+typedef int          (*mit_cmp_fn_t)(const mit_result_t *a,
+    const mit_result_t *b, void *ctx);
+typedef uint64_t     (*mit_hash_fn_t)(const mit_result_t *value, void *ctx);
+typedef int          (*mit_eq_fn_t)(const mit_result_t *a,
+    const mit_result_t *b, void *ctx);
 typedef void         (*mit_free_fn_t)(void *ctx);
+#ifdef MIT_UCONTEXT
+typedef mit_status_t (*mit_fiber_fn_t)(mit_fiber_t *fiber, void *ctx);
+#endif
+
+/* stackless generators: a next function written as a loop that resumes
+ * after the last MIT_YIELD on every call.  Anything that must survive a
+ * yield has to live in the context rather than in locals, and MIT_YIELD
+ * may not be used inside a switch statement. */
+typedef struct mit_gen_t {
+  int resume;
+} mit_gen_t;
+
+#define MIT_GEN_INIT { 0 }
+
+#define MIT_GEN_BEGIN(gen) switch ((gen)->resume) { case 0:
+
+#define MIT_YIELD(gen, result, value) \
+  do { \
+    (gen)->resume = __LINE__; \
+    *(result) = (value); \
+    return MIT_OK; \
+    case __LINE__:; \
+  } while (0)
+
+#define MIT_GEN_END(gen) } (gen)->resume = -1; return MIT_EXHAUSTED
+
+typedef void *(*mit_malloc_fn_t)(size_t size);
+typedef void *(*mit_realloc_fn_t)(void *ptr, size_t size);
+typedef void  (*mit_dealloc_fn_t)(void *ptr);
+
+void mit_set_allocator(mit_malloc_fn_t mallocfn,
+    mit_realloc_fn_t reallocfn, mit_dealloc_fn_t deallocfn);
+void mit_alloc_counts(size_t *allocs, size_t *deallocs);
+
+mit_arena_t *mit_arena_new(size_t size);
+mit_arena_t *mit_arena_init(void *buf, size_t size);
+void mit_arena_free(mit_arena_t *arena);
 
 mit_t *mit_new(mit_next_fn_t next, void *ctx, mit_free_fn_t freefn);
 mit_t *mit_finite_new(mit_next_fn_t next, void *ctx, mit_free_fn_t freefn);
+mit_t *mit_new_in(mit_arena_t *arena,
+    mit_next_fn_t next, void *ctx, mit_free_fn_t freefn);
+mit_t *mit_finite_new_in(mit_arena_t *arena,
+    mit_next_fn_t next, void *ctx, mit_free_fn_t freefn);
+mit_t *mit_init(mit_storage_t *storage,
+    mit_next_fn_t next, void *ctx, mit_free_fn_t freefn);
+mit_t *mit_finite_init(mit_storage_t *storage,
+    mit_next_fn_t next, void *ctx, mit_free_fn_t freefn);
+mit_t *mit_sized_new(mit_next_sized_fn_t next,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_finite_sized_new(mit_next_sized_fn_t next,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_from_array(void **values, size_t n);
+mit_t *mit_from_strided(void *base, size_t n, size_t stride);
+mit_t *mit_from_strv(char **strv);
+mit_t *mit_range(intptr_t start, intptr_t stop, intptr_t step);
+#ifdef MIT_POSIX
+mit_t *mit_from_file_lines(const char *path, int delim);
+mit_t *mit_from_fd(int fd, int delim, size_t bufsize);
+#endif
 mit_t *mit_grep(mit_t *mit, mit_grep_fn_t fn, void *ctx, mit_free_fn_t freefn);
 mit_t *mit_map(mit_t *mit, mit_map_fn_t fn, void *ctx, mit_free_fn_t freefn);
+mit_t *mit_grep_sized(mit_t *mit, mit_grep_sized_fn_t fn,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_map_sized(mit_t *mit, mit_map_sized_fn_t fn,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_grep_batch(mit_t *mit, mit_grep_batch_fn_t fn,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_map_pure(mit_t *mit, mit_map_fn_t fn,
+    void *ctx, mit_free_fn_t freefn);
 mit_t *mit_chain(mit_t *mit1, mit_t *mit2);
+mit_t *mit_chain_n(mit_t **mits, size_t n);
+mit_t *mit_take(mit_t *mit, size_t n);
+mit_t *mit_take_while(mit_t *mit, mit_grep_fn_t fn,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_skip_while(mit_t *mit, mit_grep_fn_t fn,
+    void *ctx, mit_free_fn_t freefn);
+mit_t *mit_chunk(mit_t *mit, size_t n);
+mit_t *mit_window(mit_t *mit, size_t size, size_t step);
+mit_t *mit_merge_sorted(mit_t **mits, size_t k,
+    mit_cmp_fn_t cmp, void *ctx, int stable);
+mit_t *mit_sort(mit_t *mit, mit_cmp_fn_t cmp, void *ctx,
+    size_t mem_limit, const char *tmpdir);
+mit_t *mit_distinct(mit_t *mit, mit_hash_fn_t hashfn, mit_eq_fn_t eqfn,
+    void *ctx);
+mit_t *mit_distinct_approx(mit_t *mit, mit_hash_fn_t hashfn, void *ctx,
+    size_t mem_limit);
+mit_t *mit_group_aggregate(mit_t *mit, mit_map_sized_fn_t keyfn,
+    mit_init_fn_t init, mit_fold_fn_t combine, void *ctx,
+    mit_free_fn_t freefn);
+mit_t *mit_group_aggregate_spill(mit_t *mit, mit_map_sized_fn_t keyfn,
+    mit_init_fn_t init, mit_fold_fn_t combine, void *ctx,
+    mit_free_fn_t freefn, size_t mem_limit, const char *tmpdir);
+mit_t *mit_hash_join(mit_t *build, mit_t *probe,
+    mit_map_sized_fn_t build_key, mit_map_sized_fn_t probe_key, void *ctx);
+#ifdef MIT_UCONTEXT
+mit_t *mit_fiber_new(mit_fiber_fn_t fn, void *ctx, mit_free_fn_t freefn,
+    size_t stacksize);
+int    mit_fiber_yield(mit_fiber_t *fiber, void *value);
+#endif
+#ifdef MIT_THREADS
+mit_t *mit_prefetch(mit_t *mit, size_t depth);
+mit_t *mit_par_map(mit_t *mit, mit_map_fn_t fn, void *ctx,
+    size_t nthreads, int ordered);
+#endif
 void   mit_free(mit_t *mit);
+void   mit_fini(mit_t *mit);
+
+#if defined(MIT_POSIX) && defined(__linux__)
+typedef int (*mit_loop_fn_t)(mit_t *mit, mit_result_t *result, void *ctx);
+
+mit_loop_t *mit_loop_new(void);
+int         mit_loop_add(mit_loop_t *loop,
+    mit_t *mit, mit_loop_fn_t fn, void *ctx);
+int         mit_loop_run(mit_loop_t *loop);
+void        mit_loop_free(mit_loop_t *loop);
+#endif
+
+void mit_set_batchfn(mit_t *mit, mit_batch_fn_t batchfn);
+void mit_set_batch_sizedfn(mit_t *mit, mit_batch_sized_fn_t batchfn);
+void mit_set_skipfn(mit_t *mit, mit_skip_fn_t skipfn);
+void mit_set_sizefn(mit_t *mit, mit_size_fn_t sizefn);
+void mit_set_fdfn(mit_t *mit, mit_fd_fn_t fdfn);
 
 mit_result_t *mit_next(mit_t *mit);
 mit_result_t *mit_peek(mit_t *mit);
 mit_result_t *mit_nth(mit_t *mit, size_t n);
 mit_status_t  mit_skip(mit_t *mit, size_t n);
+size_t        mit_next_batch(mit_t *mit, void **values, size_t n);
+size_t        mit_next_batch_sized(mit_t *mit,
+    void **values, size_t *lens, size_t n);
+int           mit_size_hint(mit_t *mit, size_t *remaining);
+int           mit_contiguous(mit_t *mit,
+    void **base, size_t *count, size_t *stride);
+size_t       *mit_window_lens(mit_t *mit);
+int           mit_pending_fd(mit_t *mit);
+mit_status_t  mit_fold(mit_t *mit, mit_fold_fn_t fn, void *ctx, void **acc);
+mit_status_t  mit_reduce(mit_t *mit, mit_fold_fn_t fn, void *ctx, void **acc);
 
 mit_status_t mit_status(mit_t *mit);
 int mit_is_ready(mit_t *mit);
 int mit_is_error(mit_t *mit);
 int mit_is_exhausted(mit_t *mit);
+int mit_is_pending(mit_t *mit);
 int mit_is_finite(mit_t *mit);
+int mit_is_sized(mit_t *mit);
 
 void *mit_ctx(mit_t *mit);
 
+#ifdef MIT_STATS
+typedef struct mit_stats_t {
+  unsigned long long calls;     /* next function invocations */
+  unsigned long long batches;   /* batch function invocations */
+  unsigned long long peek_hits; /* retrievals served from the peek cache */
+  unsigned long long yielded;   /* values handed to the caller */
+  unsigned long long errors;
+  unsigned long long cycles;    /* time spent in callbacks (MIT_STATS_CYCLES) */
+} mit_stats_t;
+
+const mit_stats_t *mit_stats(mit_t *mit);
+void mit_stats_dump(mit_t *mit, FILE *stream);
+#endif
+
 #endif /* MITERATOR_H */
 
 /* vim: set ts=2 sw=2 et: */
@@ -0,0 +1,104 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+const int limit = 10;
+int batch_called = 0;
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= limit) { return MIT_EXHAUSTED; }
+  else { ++(*c); *result = (void *)(intptr_t) * c; return MIT_OK; }
+}
+
+mit_status_t batchfn(void *ctx, void **values, size_t n, size_t *count) {
+  int *c = ctx;
+  ++batch_called;
+  for (*count = 0; *count < n && *c < limit; ++(*count)) {
+    values[*count] = (void *)(intptr_t) ++(*c);
+  }
+  return *c >= limit ? MIT_EXHAUSTED : MIT_OK;
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 2) { return MIT_ERROR; }
+  *result = (void *)(intptr_t) * c;
+  return MIT_OK;
+}
+
+mit_status_t grepfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = !((intptr_t)value % 2);
+  return MIT_OK;
+}
+
+mit_status_t mapfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = (void *)((intptr_t)value * 10);
+  return MIT_OK;
+}
+
+int main(void) {
+  int ctx1 = 0, ctx2 = 0;
+  void *values[4];
+  mit_t *mit;
+
+  tap_plan(29);
+
+  /* scalar fallback */
+  mit = mit_new(nextfn, &ctx1, NULL);
+  tap_is_int(mit_next_batch(mit, values, 4), 4, "fallback fills batch");
+  tap_is_int((intptr_t)values[3], 4, "fallback values are correct");
+  tap_is_int((intptr_t)mit_peek(mit)->value, 5, "peek after batch");
+  values[0] = NULL;
+  tap_is_int(mit_next_batch(mit, values, 0), 0, "empty batch after peek");
+  tap_ok(values[0] == NULL && mit->next_set, "peeked value kept");
+  tap_is_int(mit_next_batch(mit, values, 4), 1, "cached peek returned alone");
+  tap_is_int((intptr_t)values[0], 5, "cached peek value is correct");
+  tap_is_int(mit_next_batch(mit, values, 4), 4, "second batch is full");
+  tap_is_int(mit_next_batch(mit, values, 4), 1, "final batch is short");
+  tap_is_int((intptr_t)values[0], 10, "final value is correct");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "iterator is exhausted");
+  tap_is_int(mit_next_batch(mit, values, 4), 0, "exhausted batch is empty");
+  mit_free(mit);
+
+  /* native batch producer */
+  ctx1 = 0;
+  mit = mit_new(nextfn, &ctx1, NULL);
+  mit_set_batchfn(mit, batchfn);
+  tap_is_int(mit_next_batch(mit, values, 4), 4, "batchfn fills batch");
+  tap_is_int(batch_called, 1, "batchfn called");
+  tap_is_int((intptr_t)mit_next(mit)->value, 5, "next after batch");
+  mit_free(mit);
+
+  /* pipeline */
+  ctx1 = 0;
+  mit = mit_new(nextfn, &ctx1, NULL);
+  mit_set_batchfn(mit, batchfn);
+  mit = mit_chain(mit, mit_new(nextfn, &ctx2, NULL));
+  mit = mit_map(mit_grep(mit, grepfn, NULL, NULL), mapfn, NULL, NULL);
+  tap_is_int(mit_next_batch(mit, values, 4), 2, "pipeline filters batch");
+  tap_is_int((intptr_t)values[0], 20, "pipeline value 1");
+  tap_is_int((intptr_t)values[1], 40, "pipeline value 2");
+  tap_is_int(mit_next_batch(mit, values, 4), 2, "pipeline batch 2");
+  tap_is_int(mit_next_batch(mit, values, 4), 1, "pipeline drains first source");
+  tap_is_int((intptr_t)values[0], 100, "pipeline value 5");
+  tap_is_int(mit_next_batch(mit, values, 4), 2, "pipeline reads second source");
+  tap_is_int((intptr_t)values[1], 40, "pipeline value 7");
+  tap_is_int(mit_next_batch(mit, values, 4), 2, "pipeline batch 5");
+  tap_is_int(mit_next_batch(mit, values, 4), 1, "pipeline drains second source");
+  tap_is_int(mit_next_batch(mit, values, 4), 0, "pipeline is empty");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "pipeline is exhausted");
+  mit_free(mit);
+
+  /* errors */
+  ctx1 = 0;
+  mit = mit_new(errfn, &ctx1, NULL);
+  tap_is_int(mit_next_batch(mit, values, 4), 2, "values before error returned");
+  tap_is_int(mit_status(mit), MIT_ERROR, "error status set");
+
+  mit_free(mit);
+
+  return tap_finish();
+}
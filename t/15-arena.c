@@ -0,0 +1,94 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+const int limit = 4;
+int malloc_called = 0;
+int free_called = 0;
+int ctx_freed = 0;
+
+void *mallocfn(size_t size) {
+  ++malloc_called;
+  return malloc(size);
+}
+
+void deallocfn(void *ptr) {
+  ++free_called;
+  free(ptr);
+}
+
+void freefn(void *v) {
+  (void)v;
+  ++ctx_freed;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= limit) { return MIT_EXHAUSTED; }
+  else { ++(*c); *result = c; return MIT_OK; }
+}
+
+mit_status_t grepfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = !(*((int *)value) % 2);
+  return MIT_OK;
+}
+
+mit_status_t mapfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = value;
+  return MIT_OK;
+}
+
+mit_t *pipeline(mit_arena_t *arena, int *ctx1, int *ctx2) {
+  mit_t *mit = mit_chain(mit_new_in(arena, nextfn, ctx1, freefn),
+          mit_new_in(arena, nextfn, ctx2, freefn));
+  return mit_map(mit_grep(mit, grepfn, NULL, freefn), mapfn, NULL, freefn);
+}
+
+int main(void) {
+  int ctx1 = 0, ctx2 = 0, count = 0;
+  size_t allocs, deallocs;
+  mit_arena_t *arena;
+  mit_t *mit, *first;
+
+  tap_plan(12);
+
+  mit_set_allocator(mallocfn, NULL, deallocfn);
+
+  /* heap allocated pipeline, one allocation per iterator */
+  mit = pipeline(NULL, &ctx1, &ctx2);
+  tap_is_int(malloc_called, 5, "one allocation per iterator");
+  while (mit_next(mit)->status == MIT_OK) { ++count; }
+  tap_is_int(count, 4, "heap pipeline values");
+  mit_free(mit);
+  tap_is_int(free_called, 5, "every iterator released");
+  tap_is_int(ctx_freed, 4, "contexts freed");
+
+  mit_alloc_counts(&allocs, &deallocs);
+  tap_is_int(allocs, 5, "allocation counter");
+  tap_is_int(deallocs, 5, "deallocation counter");
+
+  /* arena allocated pipelines */
+  malloc_called = free_called = ctx_freed = 0;
+  tap_ok((arena = mit_arena_new(4096)) != NULL, "arena created");
+  tap_is_int(malloc_called, 2, "arena allocated up front");
+
+  ctx1 = ctx2 = count = 0;
+  first = mit = pipeline(arena, &ctx1, &ctx2);
+  while (mit_next(mit)->status == MIT_OK) { ++count; }
+  tap_is_int(count, 4, "arena pipeline values");
+  mit_free(mit);
+  tap_is_int(ctx_freed, 4, "arena pipeline contexts freed");
+
+  ctx1 = ctx2 = 0;
+  mit = pipeline(arena, &ctx1, &ctx2);
+  tap_ok(mit == first, "arena memory reused after root freed");
+  mit_free(mit);
+
+  tap_is_int(malloc_called, 2, "no allocations for arena pipelines");
+
+  mit_arena_free(arena);
+
+  return tap_finish();
+}
@@ -0,0 +1,76 @@
+#define MIT_STATS
+#define MIT_STATS_CYCLES
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+const int limit = 10;
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= limit) { return MIT_EXHAUSTED; }
+  else { ++(*c); *result = (void *)(intptr_t) * c; return MIT_OK; }
+}
+
+mit_status_t grepfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = !((intptr_t)value % 2);
+  return MIT_OK;
+}
+
+mit_status_t mapfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = value;
+  return MIT_OK;
+}
+
+int main(void) {
+  int ctx1 = 0, ctx2 = 0;
+  char buf[1024];
+  size_t len, i;
+  const mit_stats_t *st;
+  mit_t *src, *mit;
+  FILE *stream;
+
+  tap_plan(13);
+
+  src = mit_new(nextfn, &ctx1, NULL);
+  mit = mit_map(mit_grep(src, grepfn, NULL, NULL), mapfn, NULL, NULL);
+  mit = mit_chain(mit, mit_new(nextfn, &ctx2, NULL));
+
+  mit_peek(mit);
+  mit_peek(mit);
+  for (i = 0; i < 5; i++) { mit_next(mit); }
+
+  st = mit_stats(mit);
+  tap_is_int(st->calls, 5, "chain next calls");
+  tap_is_int(st->peek_hits, 2, "peek hits");
+  tap_is_int(st->yielded, 5, "values yielded");
+  tap_is_int(st->errors, 0, "no errors");
+  tap_ok(st->cycles > 0, "cycles recorded");
+
+  st = mit_stats(src);
+  tap_is_int(st->calls, 10, "source next calls");
+  tap_is_int(st->yielded, 10, "source values yielded");
+
+  tap_ok((stream = tmpfile()) != NULL, "dump stream opened");
+  mit_stats_dump(mit, stream);
+  rewind(stream);
+  len = fread(buf, 1, sizeof(buf) - 1, stream);
+  buf[len] = '\0';
+  fclose(stream);
+
+  tap_ok(strstr(buf, "chain: calls 5") != NULL, "dump includes chain");
+  tap_ok(strstr(buf, "  grep/map: calls 5") != NULL, "dump includes pipeline");
+  tap_ok(strstr(buf, "stage 0 grep: in 10 out 5 dropped 5 selectivity 50.0%")
+      != NULL, "dump includes grep selectivity");
+  tap_ok(strstr(buf, "stage 1 map: in 5 out 5") != NULL, "dump includes map");
+
+  while (mit_next(mit)->status == MIT_OK);
+  tap_is_int(mit_stats(mit)->yielded, 15, "all values yielded");
+
+  mit_free(mit);
+
+  return tap_finish();
+}
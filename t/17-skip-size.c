@@ -0,0 +1,105 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+/* a counter that can jump ahead */
+
+struct counter {
+  size_t i, n;
+};
+
+int next_called = 0, skip_called = 0, map_called = 0;
+
+mit_status_t nextfn(void *ctx, void **result) {
+  struct counter *c = ctx;
+  ++next_called;
+  if (c->i >= c->n) { return MIT_EXHAUSTED; }
+  *result = (void *)(uintptr_t)++c->i;
+  return MIT_OK;
+}
+
+mit_status_t skipfn(void *ctx, size_t n, size_t *skipped) {
+  struct counter *c = ctx;
+  ++skip_called;
+  *skipped = n < c->n - c->i ? n : c->n - c->i;
+  c->i += *skipped;
+  return *skipped == n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+int sizefn(void *ctx, size_t *remaining) {
+  struct counter *c = ctx;
+  *remaining = c->n - c->i;
+  return 1;
+}
+
+mit_status_t mapfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  ++map_called;
+  *result = value;
+  return MIT_OK;
+}
+
+mit_status_t grepfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = (uintptr_t)value % 2;
+  return MIT_OK;
+}
+
+mit_t *counter(struct counter *c, size_t n) {
+  mit_t *mit = mit_new(nextfn, c, NULL);
+  c->i = 0;
+  c->n = n;
+  mit_set_skipfn(mit, skipfn);
+  mit_set_sizefn(mit, sizefn);
+  return mit;
+}
+
+int main(void) {
+  struct counter c1, c2;
+  size_t size;
+  mit_t *mit;
+
+  tap_plan(20);
+
+  mit = counter(&c1, 2000000);
+  tap_ok(mit_size_hint(mit, &size) && size == 2000000, "initial size");
+  tap_is_int((uintptr_t)mit_nth(mit, 1000000)->value, 1000001, "nth value");
+  tap_is_int(next_called, 1, "skip did not call next");
+  tap_is_int(skip_called, 1, "skip function used");
+  tap_is_int((uintptr_t)mit_peek(mit)->value, 1000002, "peek after skip");
+  tap_ok(mit_size_hint(mit, &size) && size == 999999, "size includes peek");
+  tap_is_int(mit_skip(mit, 2000000), MIT_EXHAUSTED, "skip past the end");
+  tap_ok(mit_size_hint(mit, &size) && size == 0, "exhausted size");
+  mit_free(mit);
+
+  /* chains and pure maps forward */
+  next_called = skip_called = 0;
+  mit = mit_chain(counter(&c1, 100), counter(&c2, 100));
+  mit = mit_map_pure(mit, mapfn, NULL, NULL);
+  tap_ok(mit_size_hint(mit, &size) && size == 200, "chain size");
+  tap_is_int((uintptr_t)mit_nth(mit, 150)->value, 51, "nth across chain");
+  tap_is_int(next_called, 1, "chain skip did not call next");
+  tap_is_int(map_called, 1, "pure map skipped");
+  tap_ok(mit_size_hint(mit, &size) && size == 49, "chain size after skip");
+  mit_free(mit);
+
+  /* impure maps and greps do not */
+  next_called = skip_called = map_called = 0;
+  mit = mit_map(counter(&c1, 100), mapfn, NULL, NULL);
+  tap_ok(mit_size_hint(mit, &size) && size == 100, "map size forwarded");
+  tap_is_int((uintptr_t)mit_nth(mit, 10)->value, 11, "nth through map");
+  tap_is_int(map_called, 11, "impure map called for skipped values");
+  tap_is_int(skip_called, 0, "source skip not used");
+  mit_free(mit);
+
+  mit = mit_grep(counter(&c1, 100), grepfn, NULL, NULL);
+  tap_ok(!mit_size_hint(mit, &size), "grep size unknown");
+  tap_is_int((uintptr_t)mit_nth(mit, 10)->value, 21, "nth through grep");
+  mit_free(mit);
+
+  mit = mit_new(nextfn, &c1, NULL);
+  tap_ok(!mit_size_hint(mit, &size), "size unknown without size function");
+  mit_free(mit);
+
+  return tap_finish();
+}
@@ -0,0 +1,132 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+char *words[] = { "a", "bbb", "cc", "dddd", NULL };
+
+mit_status_t nextfn(void *ctx, void **result, size_t *len) {
+  char ***w = ctx;
+  if (**w == NULL) { return MIT_EXHAUSTED; }
+  *result = **w;
+  *len = strlen(*((*w)++));
+  return MIT_OK;
+}
+
+mit_status_t batchfn(void *ctx, void **values, size_t *lens, size_t n,
+    size_t *count) {
+  for (*count = 0; *count < n; ++*count) {
+    if (nextfn(ctx, &values[*count], lens ? &lens[*count] : &n) != MIT_OK) {
+      return MIT_EXHAUSTED;
+    }
+  }
+  return MIT_OK;
+}
+
+mit_status_t plainfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= 2) { return MIT_EXHAUSTED; }
+  *result = MIT_PTR(++(*c));
+  return MIT_OK;
+}
+
+mit_status_t longfn(void *value, size_t len, void *ctx, int *matches) {
+  (void)value;
+  (void)ctx;
+  *matches = len > 1;
+  return MIT_OK;
+}
+
+/* drop the first character */
+mit_status_t tailfn(void *value, size_t len, void *ctx,
+    void **result, size_t *rlen) {
+  (void)ctx;
+  *result = (char *)value + 1;
+  *rlen = len - 1;
+  return MIT_OK;
+}
+
+mit_status_t idfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = value;
+  return MIT_OK;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  char **w = words;
+  void *values[8];
+  size_t lens[8];
+  mit_result_t *res;
+  mit_t *mit;
+  int c = 0;
+
+  tap_plan(26);
+
+  /* sized source */
+  mit = mit_finite_sized_new(nextfn, &w, NULL);
+  tap_ok(mit_is_finite(mit), "sized iterator is finite");
+  tap_ok(mit_is_sized(mit), "sized iterator is sized");
+  tap_is_int(mit_peek(mit)->len, 1, "peeked length");
+  res = mit_next(mit);
+  tap_ok(res->value == words[0] && res->len == 1, "sized value 1");
+  tap_is_int(mit_next(mit)->len, 3, "sized value 2");
+  tap_is_int(mit_next_batch_sized(mit, values, lens, 8), 2, "sized batch");
+  tap_ok(values[1] == words[3] && lens[1] == 4, "batch lengths");
+  tap_is_int(mit_next(mit)->len, 0, "exhausted length");
+  mit_free(mit);
+
+  /* sized stages are fused and pass lengths along */
+  w = words;
+  mit = mit_grep_sized(mit_sized_new(nextfn, &w, NULL), longfn, NULL, NULL);
+  mit = mit_map_sized(mit, tailfn, NULL, NULL);
+  mit = mit_grep_sized(mit, longfn, NULL, NULL);
+  tap_is_int(live(), 2, "sized stages fused");
+  tap_ok(mit_is_sized(mit), "sized stages keep values sized");
+  res = mit_next(mit);
+  tap_ok(res->value == words[1] + 1 && res->len == 2, "sized pipeline value 1");
+  res = mit_next(mit);
+  tap_ok(res->value == words[3] + 1 && res->len == 3, "sized pipeline value 2");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "sized pipeline exhausted");
+  mit_free(mit);
+
+  /* batches through sized stages without lengths */
+  w = words;
+  mit = mit_sized_new(nextfn, &w, NULL);
+  mit_set_batch_sizedfn(mit, batchfn);
+  mit = mit_grep_sized(mit, longfn, NULL, NULL);
+  tap_is_int(mit_next_batch(mit, values, 8), 3, "batch filtered by length");
+  tap_ok(values[2] == words[3], "batch value");
+  mit_free(mit);
+
+  /* chains pass lengths along, unsized maps clear them */
+  w = words;
+  mit = mit_chain(mit_new(plainfn, &c, NULL), mit_sized_new(nextfn, &w, NULL));
+  tap_ok(!mit_is_sized(mit), "chain with an unsized source is unsized");
+  tap_is_int(mit_next(mit)->len, 0, "unsized value has no length");
+  tap_is_int(mit_skip(mit, 1), MIT_OK, "skip unsized value");
+  tap_is_int(mit_next(mit)->len, 1, "chain passes length");
+  tap_is_int(mit_next_batch_sized(mit, values, lens, 1), 1, "chain batch");
+  tap_is_int(lens[0], 3, "chain batch length");
+  mit = mit_map(mit, idfn, NULL, NULL);
+  res = mit_next(mit);
+  tap_ok(res->value == words[2] && res->len == 0, "unsized map clears length");
+  mit = mit_grep_sized(mit, longfn, NULL, NULL);
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED,
+      "sized stage after unsized map sees no length");
+  mit_free(mit);
+
+  w = words;
+  mit = mit_map(mit_sized_new(nextfn, &w, NULL), idfn, NULL, NULL);
+  tap_ok(!mit_is_sized(mit), "unsized map drops the lengths");
+  mit_free(mit);
+
+  tap_is_int(live(), 0, "all iterators released");
+  tap_ok(sizeof(mit_result_t) <= 3 * sizeof(void *), "result stays small");
+
+  return tap_finish();
+}
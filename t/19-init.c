@@ -0,0 +1,83 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+int freed = 0;
+
+void freefn(void *v) {
+  (void)v;
+  ++freed;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= 6) { return MIT_EXHAUSTED; }
+  *result = MIT_PTR(++(*c));
+  return MIT_OK;
+}
+
+mit_status_t evenfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = MIT_INT(value) % 2 == 0;
+  return MIT_OK;
+}
+
+mit_status_t squarefn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = MIT_PTR(MIT_INT(value) * MIT_INT(value));
+  return MIT_OK;
+}
+
+size_t allocs(void) {
+  size_t count;
+  mit_alloc_counts(&count, NULL);
+  return count;
+}
+
+int main(void) {
+  mit_storage_t storage;
+  unsigned char buf[1024];
+  mit_arena_t *arena;
+  mit_t *mit, *first;
+  size_t before;
+  int c = 0;
+
+  tap_plan(14);
+
+  /* single iterator in caller storage */
+  before = allocs();
+  mit = mit_finite_init(&storage, nextfn, &c, freefn);
+  tap_ok((void *)mit == (void *)&storage, "iterator stored in place");
+  tap_ok(mit_is_finite(mit), "finite flag set");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 1, "value 1");
+  tap_is_int(MIT_INT(mit_nth(mit, 1)->value), 3, "value 3");
+  mit_fini(mit);
+  tap_is_int(freed, 1, "context freed");
+  tap_is_int(allocs(), before, "embedded iterator not allocated");
+
+  /* an embedded iterator may be wrapped by adapters */
+  c = 0;
+  mit = mit_grep(mit_init(&storage, nextfn, &c, freefn), evenfn, NULL, NULL);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 2, "wrapped embedded iterator");
+  mit_free(mit);
+  tap_is_int(freed, 2, "embedded iterator released by adapter");
+
+  /* a whole pipeline in a caller-owned buffer */
+  tap_ok(mit_arena_init(buf, 16) == NULL, "buffer too small for an arena");
+  before = allocs();
+  arena = mit_arena_init(buf + 1, sizeof(buf) - 1);
+  c = 0;
+  first = mit = mit_new_in(arena, nextfn, &c, NULL);
+  mit = mit_map(mit_grep(mit, evenfn, NULL, NULL), squarefn, NULL, NULL);
+  tap_ok((unsigned char *)mit > buf && (unsigned char *)mit < buf + sizeof(buf),
+      "pipeline stored in buffer");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 4, "pipeline value 1");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 16, "pipeline value 2");
+  mit_free(mit);
+  tap_ok((mit = mit_new_in(arena, nextfn, &c, NULL)) == first, "buffer reused");
+  mit_free(mit);
+  mit_arena_free(arena);
+  tap_is_int(allocs(), before, "pipeline not allocated");
+
+  return tap_finish();
+}
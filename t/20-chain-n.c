@@ -0,0 +1,64 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define NEMPTY 100000
+
+int freed = 0;
+
+void freefn(void *v) {
+  (void)v;
+  ++freed;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c <= 0) { return MIT_EXHAUSTED; }
+  else { *result = (void *)(intptr_t)(*c)--; return MIT_OK; }
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  int ctx[4] = { 2, 0, 1, 1 }, zero = 0;
+  static mit_t *mits[NEMPTY + 1];
+  mit_t *mit;
+  size_t i;
+
+  tap_plan(12);
+
+  /* nested chains are flattened */
+  mit = mit_chain(mit_new(nextfn, &ctx[0], freefn),
+          mit_new(nextfn, &ctx[1], freefn));
+  mit = mit_chain(mit, mit_new(nextfn, &ctx[2], freefn));
+  mit = mit_chain(mit_new(nextfn, &ctx[3], freefn), mit);
+  tap_is_int(live(), 5, "nested chains flattened");
+  tap_ok(mit_is_finite(mit) == 0, "chain of infinite iterators is infinite");
+
+  tap_is_int((intptr_t)mit_next(mit)->value, 1, "value from fourth source");
+  tap_is_int((intptr_t)mit_next(mit)->value, 2, "value 1 from first source");
+  tap_is_int((intptr_t)mit_next(mit)->value, 1, "value 2 from first source");
+  tap_is_int(freed, 1, "exhausted source freed");
+  tap_is_int((intptr_t)mit_next(mit)->value, 1, "empty source skipped");
+  tap_is_int(freed, 3, "empty source freed");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "chain exhausted");
+  mit_free(mit);
+  tap_is_int(live(), 0, "all iterators released");
+
+  /* long runs of empty sources */
+  for (i = 0; i < NEMPTY; i++) {
+    mits[i] = mit_finite_new(nextfn, &zero, NULL);
+  }
+  ctx[0] = 1;
+  mits[NEMPTY] = mit_finite_new(nextfn, &ctx[0], NULL);
+  mit = mit_chain_n(mits, NEMPTY + 1);
+  tap_ok(mit_is_finite(mit), "chain of finite iterators is finite");
+  tap_is_int((intptr_t)mit_next(mit)->value, 1, "value after empty sources");
+  mit_free(mit);
+
+  return tap_finish();
+}
@@ -0,0 +1,189 @@
+#include <ctype.h>
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define N 100000
+
+struct records {
+  char buf[16];       /* reused for every record */
+  int i;
+};
+
+mit_status_t modfn(void *value, void *ctx, void **result) {
+  *result = MIT_PTR(MIT_INT(value) % *(int *)ctx);
+  return MIT_OK;
+}
+
+mit_status_t recordfn(void *ctx, void **result, size_t *len) {
+  static const char *words[] = { "Ab", "cd", "aB", "ef", "CD", "ab" };
+  struct records *r = ctx;
+  if (r->i >= 6) { return MIT_EXHAUSTED; }
+  *len = strlen(words[r->i]);
+  memcpy(r->buf, words[r->i++], *len);
+  *result = r->buf;
+  return MIT_OK;
+}
+
+/* records of "a\n\nb\n\n\na\n" as a lines source would return them, the
+ * empty ones at different addresses */
+mit_status_t linefn(void *ctx, void **result, size_t *len) {
+  static const char text[] = "a\n\nb\n\n\na\n";
+  static const size_t offsets[] = { 0, 2, 3, 5, 6, 7 };
+  int *i = ctx;
+  if (*i >= 6) { return MIT_EXHAUSTED; }
+  *result = (void *)(text + offsets[*i]);
+  *len = text[offsets[*i]] == '\n' ? 0 : 1;
+  (*i)++;
+  return MIT_OK;
+}
+
+/* case insensitive keys */
+uint64_t casehash(const mit_result_t *v, void *ctx) {
+  const char *s = v->value;
+  uint64_t h = 5381;
+  size_t i;
+  (void)ctx;
+  for (i = 0; i < v->len; i++) { h = h * 33 + (unsigned)tolower(s[i]); }
+  return h;
+}
+
+int caseeq(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  const char *x = a->value, *y = b->value;
+  size_t i;
+  (void)ctx;
+  if (a->len != b->len) { return 0; }
+  for (i = 0; i < a->len; i++) {
+    if (tolower(x[i]) != tolower(y[i])) { return 0; }
+  }
+  return 1;
+}
+
+/* every value collides */
+uint64_t zerohash(const mit_result_t *v, void *ctx) {
+  (void)v;
+  (void)ctx;
+  return 0;
+}
+
+int is_next(mit_t *mit, const char *expected) {
+  mit_result_t *res = mit_next(mit);
+  return res->status == MIT_OK && res->len == strlen(expected)
+      && memcmp(res->value, expected, res->len) == 0;
+}
+
+/* the table of the last stage of a fused pipe */
+struct _mit_table_t *table(mit_t *mit) {
+  struct _mit_pipe_ctx_t *pctx = mit_ctx(mit);
+  return pctx->stages[pctx->nstages - 1].ctx;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  void *values[] = { MIT_PTR(3), MIT_PTR(1), MIT_PTR(3), MIT_PTR(2),
+                     MIT_PTR(1), MIT_PTR(4)
+                   };
+  int mod = 10007, ok = 1, line;
+  struct records rec;
+  struct _mit_table_t *t;
+  mit_result_t *res;
+  size_t n;
+  mit_t *mit;
+
+  tap_plan(21);
+
+  /* first occurrences in order */
+  mit = mit_distinct(mit_from_array(values, 6), NULL, NULL, NULL);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 3, "first value");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 1, "second value");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 2, "repeat skipped");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 4, "repeats skipped");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "exhausted");
+  mit_free(mit);
+
+  /* many keys grow the table several times */
+  mit = mit_distinct(mit_map(mit_range(0, N, 1), modfn, &mod, NULL),
+          NULL, NULL, NULL);
+  t = table(mit);
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    if (MIT_INT(res->value) != (intptr_t)n) { ok = 0; }
+  }
+  tap_is_int(n, mod, "every key once");
+  tap_ok(ok, "keys in order");
+  tap_is_int(t->count, mod, "table count");
+  tap_ok(t->count * 4 <= (t->mask + 1) * 3, "load factor bounded");
+  mit_free(mit);
+
+  /* batches go through the same table */
+  mit = mit_distinct(mit_map(mit_range(0, N, 1), modfn, &mod, NULL),
+          NULL, NULL, NULL);
+  n = 0;
+  while (mit_next_batch(mit, values, 6) > 0) { n++; }
+  tap_is_int(n, (mod + 5) / 6, "batches of distinct values");
+  mit_free(mit);
+
+  /* sized keys are copied out of the reused buffer */
+  rec.i = 0;
+  mit = mit_distinct(mit_sized_new(recordfn, &rec, NULL), NULL, NULL, NULL);
+  tap_ok(is_next(mit, "Ab") && is_next(mit, "cd") && is_next(mit, "aB")
+      && is_next(mit, "ef") && is_next(mit, "CD") && is_next(mit, "ab"),
+      "sized keys compared by content");
+  mit_free(mit);
+
+  line = 0;
+  mit = mit_distinct(mit_sized_new(linefn, &line, NULL), NULL, NULL, NULL);
+  tap_ok(is_next(mit, "a") && is_next(mit, "") && is_next(mit, "b"),
+      "empty records compared by content");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "one empty record");
+  mit_free(mit);
+
+  rec.i = 0;
+  mit = mit_distinct(mit_sized_new(recordfn, &rec, NULL),
+          casehash, caseeq, NULL);
+  tap_ok(is_next(mit, "Ab") && is_next(mit, "cd") && is_next(mit, "ef"),
+      "custom hash and equality");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "custom keys exhausted");
+  mit_free(mit);
+
+  mod = 300;
+  mit = mit_distinct(mit_map(mit_range(0, 3000, 1), modfn, &mod, NULL),
+          zerohash, NULL, NULL);
+  for (n = 0; mit_next(mit)->status == MIT_OK; n++);
+  tap_is_int(n, 300, "colliding hashes");
+  mit_free(mit);
+
+  /* the filter never passes a repeat and rarely drops a new key */
+  mit = mit_distinct_approx(mit_range(0, N, 1), NULL, NULL, 256 << 10);
+  for (n = 0; mit_next(mit)->status == MIT_OK; n++);
+  tap_ok(n > N - N / 1000, "few new keys dropped");
+  mit_free(mit);
+
+  mod = 5000;
+  mit = mit_distinct_approx(mit_map(mit_range(0, N, 1), modfn, &mod, NULL),
+          NULL, NULL, 64 << 10);
+  for (n = 0; mit_next(mit)->status == MIT_OK; n++);
+  tap_ok(n <= 5000 && n > 4990, "repeats dropped");
+  mit_free(mit);
+
+  mit = mit_distinct_approx(mit_range(0, 100, 1), NULL, NULL, 0);
+  for (n = 0; mit_next(mit)->status == MIT_OK; n++);
+  tap_ok(n > 0 && n <= 100, "filter of a single block");
+  mit_free(mit);
+
+  rec.i = 0;
+  mit = mit_distinct_approx(mit_sized_new(recordfn, &rec, NULL),
+          casehash, NULL, 1024);
+  tap_ok(is_next(mit, "Ab") && is_next(mit, "cd") && is_next(mit, "ef"),
+      "approximate with custom hash");
+  mit_free(mit);
+
+  tap_is_int(live(), 0, "all memory released");
+
+  return tap_finish();
+}
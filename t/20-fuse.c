@@ -0,0 +1,72 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+const int limit = 6;
+char freed[8];
+size_t nfreed = 0;
+
+void freefn(void *v) {
+  freed[nfreed++] = *(char *)v;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= limit) { return MIT_EXHAUSTED; }
+  else { ++(*c); *result = (void *)(intptr_t) * c; return MIT_OK; }
+}
+
+mit_status_t grepfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = !((intptr_t)value % 2);
+  return MIT_OK;
+}
+
+mit_status_t addfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = (void *)((intptr_t)value + 1);
+  return MIT_OK;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  int ctx = 0;
+  char a = 'a', b = 'b', c = 'c', d = 'd';
+  mit_t *mit;
+
+  tap_plan(11);
+
+  /* map(grep(map(map(source)))) */
+  mit = mit_new(nextfn, &ctx, NULL);
+  mit = mit_map(mit, addfn, &a, freefn);
+  mit = mit_map(mit, addfn, &b, freefn);
+  mit = mit_grep(mit, grepfn, &c, freefn);
+  mit = mit_map(mit, addfn, &d, freefn);
+  tap_is_int(live(), 2, "stages fused into a single iterator");
+
+  tap_is_int((intptr_t)mit_next(mit)->value, 5, "fused value 1");
+  tap_is_int((intptr_t)mit_next(mit)->value, 7, "fused value 2");
+  tap_is_int((intptr_t)mit_next(mit)->value, 9, "fused value 3");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "fused iterator exhausted");
+
+  mit_free(mit);
+  tap_is_int(live(), 0, "fused iterator released");
+  tap_is_int(nfreed, 4, "every stage context freed");
+  tap_ok(memcmp(freed, "dcba", 4) == 0, "stage contexts freed outermost first");
+
+  /* a peeked iterator keeps its cached value */
+  ctx = 0;
+  mit = mit_map(mit_new(nextfn, &ctx, NULL), addfn, NULL, NULL);
+  tap_is_int((intptr_t)mit_peek(mit)->value, 2, "inner value peeked");
+  mit = mit_map(mit, addfn, NULL, NULL);
+  tap_is_int(live(), 3, "peeked iterator not fused");
+  tap_is_int((intptr_t)mit_next(mit)->value, 3, "peeked value preserved");
+  mit_free(mit);
+
+  return tap_finish();
+}
@@ -0,0 +1,76 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+size_t calls = 0, largest = 0;
+
+/* written so the compiler can vectorize it */
+mit_status_t multiplefn(void **values, size_t n, void *ctx,
+    unsigned char *selected) {
+  intptr_t m = MIT_INT(ctx);
+  size_t i;
+  ++calls;
+  if (n > largest) { largest = n; }
+  for (i = 0; i < n; i++) { selected[i] = MIT_INT(values[i]) % m == 0; }
+  return MIT_OK;
+}
+
+mit_status_t failfn(void **values, size_t n, void *ctx,
+    unsigned char *selected) {
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (values[i] == ctx) { return MIT_ERROR; }
+    selected[i] = 1;
+  }
+  return MIT_OK;
+}
+
+mit_status_t halvefn(void *value, void *ctx, void **result) {
+  intptr_t limit = MIT_INT(ctx);
+  if (MIT_INT(value) >= limit) { return MIT_ERROR; }
+  *result = MIT_PTR(MIT_INT(value) / 2);
+  return MIT_OK;
+}
+
+int main(void) {
+  void *values[256];
+  mit_t *mit;
+
+  tap_plan(15);
+
+  /* scalar retrieval */
+  mit = mit_grep_batch(mit_range(1, 10, 1), multiplefn, MIT_PTR(3), NULL);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 3, "scalar value 1");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 6, "scalar value 2");
+  tap_is_int(calls, 6, "predicate called per value");
+  mit_free(mit);
+
+  /* batches are selected in chunks and compacted */
+  calls = 0;
+  mit = mit_grep_batch(mit_range(0, 200, 1), multiplefn, MIT_PTR(2), NULL);
+  mit = mit_grep_batch(mit, multiplefn, MIT_PTR(3), NULL);
+  mit = mit_map(mit, halvefn, MIT_PTR(1000), NULL);
+  tap_is_int(mit_next_batch(mit, values, 256), 34, "survivors compacted");
+  tap_is_int(MIT_INT(values[1]), 3, "batch value 2");
+  tap_is_int(MIT_INT(values[33]), 99, "batch value 34");
+  tap_is_int(largest, 64, "predicate sees chunks");
+  tap_is_int(calls, 4 + 2, "predicate called per chunk");
+  tap_is_int(mit_next_batch(mit, values, 256), 0, "range exhausted");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "pipeline exhausted");
+  mit_free(mit);
+
+  /* errors keep the values before the failing one */
+  mit = mit_grep_batch(mit_range(0, 10, 1), failfn, MIT_PTR(20), NULL);
+  mit = mit_map(mit, halvefn, MIT_PTR(5), NULL);
+  tap_is_int(mit_next_batch(mit, values, 8), 5, "values before map error");
+  tap_is_int(MIT_INT(values[4]), 2, "last value before map error");
+  tap_is_int(mit_status(mit), MIT_ERROR, "map error reported");
+  mit_free(mit);
+
+  mit = mit_grep_batch(mit_range(0, 10, 1), failfn, MIT_PTR(3), NULL);
+  tap_is_int(mit_next_batch(mit, values, 8), 0, "failed chunk dropped");
+  tap_is_int(mit_status(mit), MIT_ERROR, "predicate error reported");
+  mit_free(mit);
+
+  return tap_finish();
+}
@@ -0,0 +1,330 @@
+#define _POSIX_C_SOURCE 200809L
+#define MIT_POSIX
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define N 200000
+#define KEYS 50000
+
+struct records {
+  char buf[16];       /* reused for every record */
+  int i, n;
+};
+
+struct summary {
+  intptr_t count;
+  intptr_t sum;
+};
+
+int freed = 0;
+
+mit_status_t sumfn(void *acc, void *value, size_t len, void *ctx,
+    void **result) {
+  (void)len;
+  (void)ctx;
+  *result = MIT_PTR(MIT_INT(acc) + MIT_INT(value));
+  return MIT_OK;
+}
+
+mit_status_t countfn(void *acc, void *value, size_t len, void *ctx,
+    void **result) {
+  (void)value;
+  (void)len;
+  (void)ctx;
+  *result = MIT_PTR(MIT_INT(acc) + 1);
+  return MIT_OK;
+}
+
+mit_status_t maxfn(void *acc, void *value, size_t len, void *ctx,
+    void **result) {
+  (void)len;
+  (void)ctx;
+  *result = MIT_INT(value) > MIT_INT(acc) ? value : acc;
+  return MIT_OK;
+}
+
+mit_status_t failfn(void *acc, void *value, size_t len, void *ctx,
+    void **result) {
+  (void)len;
+  (void)ctx;
+  *result = acc;
+  return MIT_INT(value) == 10 ? MIT_ERROR : MIT_OK;
+}
+
+mit_status_t modfn(void *value, size_t len, void *ctx, void **key,
+    size_t *keylen) {
+  (void)len;
+  *key = MIT_PTR(MIT_INT(value) % *(int *)ctx);
+  *keylen = 0;
+  return MIT_OK;
+}
+
+mit_status_t keyof(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = ((mit_pair_t *)value)->first;
+  return MIT_OK;
+}
+
+mit_status_t statinit(void *key, size_t keylen, void *ctx, void **result) {
+  struct summary *st = malloc(sizeof(*st));
+  (void)key;
+  (void)keylen;
+  (void)ctx;
+  if (st == NULL) { return MIT_ERROR; }
+  st->count = st->sum = 0;
+  *result = st;
+  return MIT_OK;
+}
+
+mit_status_t statfn(void *acc, void *value, size_t len, void *ctx,
+    void **result) {
+  struct summary *st = acc;
+  (void)ctx;
+  st->count++;
+  st->sum += (intptr_t)len;
+  (void)value;
+  *result = st;
+  return MIT_OK;
+}
+
+void statfree(void *acc) {
+  free(acc);
+  freed++;
+}
+
+/* records "k0" to "k<n-1>" repeated */
+mit_status_t recordfn(void *ctx, void **result, size_t *len) {
+  struct records *r = ctx;
+  if (r->i >= N) { return MIT_EXHAUSTED; }
+  *len = (size_t)sprintf(r->buf, "k%d", (r->i++ * 7919) % r->n);
+  *result = r->buf;
+  return MIT_OK;
+}
+
+/* 40 keys twice, every third one padded to 250 bytes */
+mit_status_t mixedfn(void *ctx, void **result, size_t *len) {
+  static char buf[256];
+  int *i = ctx, key;
+  if (*i >= 80) { return MIT_EXHAUSTED; }
+  key = (*i)++ % 40;
+  *len = key % 3 ? 5 : 250;
+  memset(buf, 'x', *len);
+  buf[sprintf(buf, "k%02d", key)] = 'x';
+  *result = buf;
+  return MIT_OK;
+}
+
+/* records of "a\n\nb\n\n\na\n" as a lines source would return them, the
+ * empty ones at different addresses */
+mit_status_t linefn(void *ctx, void **result, size_t *len) {
+  static const char text[] = "a\n\nb\n\n\na\n";
+  static const size_t offsets[] = { 0, 2, 3, 5, 6, 7 };
+  int *i = ctx;
+  if (*i >= 6) { return MIT_EXHAUSTED; }
+  *result = (void *)(text + offsets[*i]);
+  *len = text[offsets[*i]] == '\n' ? 0 : 1;
+  (*i)++;
+  return MIT_OK;
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 5000) { return MIT_ERROR; }
+  *result = MIT_PTR(*c % 10);
+  return MIT_OK;
+}
+
+int spilled(mit_t *mit) {
+  struct _mit_group_ctx_t *s = mit_ctx(mit);
+  return s->in != NULL || s->pending != NULL;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  static int counts[KEYS];
+  char dir[] = "/tmp/mit-group-test-XXXXXX";
+  int ctx = 0, mod = 7, ok = 1;
+  struct records rec;
+  mit_result_t *res;
+  mit_pair_t *pair;
+  void *acc, *values[8];
+  size_t n, count;
+  intptr_t keys;
+  mit_t *mit;
+
+  tap_plan(33);
+
+  /* terminals */
+  acc = MIT_PTR(0);
+  mit = mit_range(0, 100, 1);
+  tap_is_int(mit_fold(mit, sumfn, NULL, &acc), MIT_OK, "fold drained");
+  tap_is_int(MIT_INT(acc), 4950, "fold result");
+  tap_ok(mit_is_exhausted(mit), "folded iterator exhausted");
+  mit_free(mit);
+
+  mit = mit_range(5, 100, 7);
+  tap_is_int(mit_reduce(mit, maxfn, NULL, &acc), MIT_OK, "reduce drained");
+  tap_is_int(MIT_INT(acc), 96, "reduce result");
+  mit_free(mit);
+
+  acc = MIT_PTR(-1);
+  mit = mit_range(0, 0, 1);
+  tap_is_int(mit_reduce(mit, maxfn, NULL, &acc), MIT_EXHAUSTED,
+      "reduce of nothing");
+  tap_is_int(MIT_INT(acc), -1, "accumulator untouched");
+  mit_free(mit);
+
+  acc = MIT_PTR(0);
+  mit = mit_range(0, 100, 1);
+  tap_is_int(mit_fold(mit, failfn, NULL, &acc), MIT_ERROR, "fold error");
+  mit_free(mit);
+
+  mit = mit_new(errfn, &ctx, NULL);
+  tap_is_int(mit_fold(mit, sumfn, NULL, &acc), MIT_ERROR, "input error");
+  mit_free(mit);
+
+  /* counts by key */
+  mit = mit_group_aggregate(mit_range(0, 1000, 1), modfn, NULL, countfn,
+          &mod, NULL);
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    pair = res->value;
+    if (MIT_INT(pair->second)
+        != (MIT_INT(pair->first) < 1000 % 7 ? 143 : 142)) {
+      ok = 0;
+    }
+  }
+  tap_is_int(n, 7, "one pair per key");
+  tap_ok(ok, "counts per key");
+  tap_is_int(res->status, MIT_EXHAUSTED, "groups exhausted");
+  mit_free(mit);
+
+  /* the pair is reused, so a batch holds a single group */
+  mod = 4;
+  mit = mit_group_aggregate(mit_range(0, 100, 1), modfn, NULL, countfn,
+          &mod, NULL);
+  ok = 1;
+  keys = 0;
+  for (n = 0; (count = mit_next_batch(mit, values, 8)) > 0; n++) {
+    pair = values[0];
+    if (count != 1 || MIT_INT(pair->second) != 25) { ok = 0; }
+    keys |= (intptr_t)1 << MIT_INT(pair->first);
+  }
+  tap_ok(n == 4 && keys == 0xf, "batches of groups");
+  tap_ok(ok, "batched counts");
+  mit_free(mit);
+
+  mit = mit_map(mit_group_aggregate(mit_range(0, 100, 1), modfn, NULL,
+          countfn, &mod, NULL), keyof, NULL, NULL);
+  keys = 0;
+  for (n = 0; (count = mit_next_batch(mit, values, 8)) > 0; n += count) {
+    keys |= (intptr_t)1 << MIT_INT(values[0]);
+  }
+  tap_is_int(n, 4, "batches through a map");
+  tap_is_int(keys, 0xf, "every key mapped");
+  mit_free(mit);
+
+  /* sized keys and allocated accumulators */
+  rec.i = 0;
+  rec.n = 100;
+  mit = mit_group_aggregate(mit_sized_new(recordfn, &rec, NULL), NULL,
+          statinit, statfn, NULL, statfree);
+  ok = 1;
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    struct summary *st;
+    pair = res->value;
+    st = pair->second;
+    if (st->count != N / 100 || st->sum != st->count * (intptr_t)pair->firstlen
+        || ((char *)pair->first)[0] != 'k') {
+      ok = 0;
+    }
+  }
+  tap_is_int(n, 100, "sized keys");
+  tap_ok(ok, "accumulators per key");
+  mit_free(mit);
+
+  ctx = 0;
+  mit = mit_group_aggregate(mit_sized_new(linefn, &ctx, NULL), NULL, NULL,
+          countfn, NULL, NULL);
+  ok = 1;
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    pair = res->value;
+    if (MIT_INT(pair->second) != (pair->firstlen == 0 ? 3
+            : ((char *)pair->first)[0] == 'a' ? 2 : 1)) {
+      ok = 0;
+    }
+  }
+  tap_is_int(n, 3, "empty keys in one group");
+  tap_ok(ok, "empty key counts");
+  mit_free(mit);
+  tap_is_int(freed, 100, "accumulators released");
+
+  freed = 0;
+  rec.i = 0;
+  mit = mit_group_aggregate(mit_sized_new(recordfn, &rec, NULL), NULL,
+          statinit, statfn, NULL, statfree);
+  mit_next(mit);
+  mit_next(mit);
+  mit_free(mit);
+  tap_is_int(freed, 100, "unreturned accumulators released");
+
+  /* partitions spilled to disk */
+  tap_ok(mkdtemp(dir) != NULL, "temporary directory");
+  mod = KEYS;
+  mit = mit_group_aggregate_spill(mit_range(0, N, 1), modfn, NULL, countfn,
+          &mod, NULL, 64 << 10, dir);
+  res = mit_next(mit);
+  tap_ok(spilled(mit), "groups spilled");
+  ok = 1;
+  for (n = 0; res->status == MIT_OK; n++, res = mit_next(mit)) {
+    pair = res->value;
+    if (MIT_INT(pair->second) != N / KEYS) { ok = 0; }
+    counts[MIT_INT(pair->first)]++;
+  }
+  tap_is_int(n, KEYS, "every group once");
+  for (n = 0; n < KEYS; n++) {
+    if (counts[n] != 1) { ok = 0; }
+  }
+  tap_ok(ok, "spilled counts");
+  mit_free(mit);
+
+  freed = 0;
+  rec.i = 0;
+  rec.n = 20000;
+  mit = mit_group_aggregate_spill(mit_sized_new(recordfn, &rec, NULL), NULL,
+          statinit, statfn, NULL, statfree, 32 << 10, dir);
+  ok = 1;
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    struct summary *st;
+    pair = res->value;
+    st = pair->second;
+    if (st->count != N / 20000) { ok = 0; }
+  }
+  tap_is_int(n, 20000, "spilled sized keys");
+  tap_ok(ok, "spilled accumulators");
+  mit_free(mit);
+  tap_is_int(freed, 20000, "spilled accumulators released");
+
+  /* the limit is reached while the table is migrating */
+  ctx = 0;
+  mit = mit_group_aggregate_spill(mit_sized_new(mixedfn, &ctx, NULL), NULL,
+          NULL, countfn, NULL, NULL, 68640, dir);
+  ok = 1;
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    if (MIT_INT(((mit_pair_t *)res->value)->second) != 2) { ok = 0; }
+  }
+  tap_is_int(n, 40, "spilled keys stay out of the table");
+  tap_ok(ok, "spilled keys counted once");
+  mit_free(mit);
+
+  tap_ok(rmdir(dir) == 0, "no files left behind");
+  tap_is_int(live(), 0, "all memory released");
+
+  return tap_finish();
+}
@@ -0,0 +1,211 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+struct row {
+  intptr_t id;
+  const char *name;
+};
+
+struct records {
+  char buf[16];       /* reused for every record */
+  int i, n, step;
+};
+
+struct lines {
+  const char *text;
+  int i;
+};
+
+struct row rows[] = {
+  { 1, "one" }, { 2, "two" }, { 1, "uno" }, { 3, "three" }, { 1, "eins" }
+};
+
+/* two copies, so records never share an address */
+const char text1[] = "a\n\nb\n\n\na\n", text2[] = "a\n\nb\n\n\na\n";
+
+int freed = 0, count = 0;
+
+mit_status_t rowfn(void *ctx, void **result) {
+  int *i = ctx;
+  if (*i >= 5) { return MIT_EXHAUSTED; }
+  *result = &rows[(*i)++];
+  return MIT_OK;
+}
+
+void freefn(void *ctx) {
+  (void)ctx;
+  freed++;
+}
+
+mit_status_t idfn(void *value, size_t len, void *ctx, void **key,
+    size_t *keylen) {
+  struct row *r = value;
+  (void)len;
+  (void)ctx;
+  *key = MIT_PTR(r->id);
+  *keylen = 0;
+  return MIT_OK;
+}
+
+mit_status_t recordfn(void *ctx, void **result, size_t *len) {
+  struct records *r = ctx;
+  if (r->i >= r->n) { return MIT_EXHAUSTED; }
+  *len = (size_t)sprintf(r->buf, "k%d", r->i++ * r->step);
+  *result = r->buf;
+  return MIT_OK;
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 10) { return MIT_ERROR; }
+  *result = MIT_PTR(*c);
+  return MIT_OK;
+}
+
+/* probe ids, 0 has no match */
+mit_status_t probefn(void *ctx, void **result) {
+  static const int ids[] = { 1, 2, 0, 3, 1 };
+  int *c = ctx;
+  if (*c >= 5) { return MIT_EXHAUSTED; }
+  *result = MIT_PTR(ids[(*c)++]);
+  count++;
+  return MIT_OK;
+}
+
+/* records of text as a lines source would return them */
+mit_status_t linefn(void *ctx, void **result, size_t *len) {
+  static const size_t offsets[] = { 0, 2, 3, 5, 6, 7 };
+  struct lines *l = ctx;
+  if (l->i >= 6) { return MIT_EXHAUSTED; }
+  *result = (void *)(l->text + offsets[l->i]);
+  *len = l->text[offsets[l->i]] == '\n' ? 0 : 1;
+  l->i++;
+  return MIT_OK;
+}
+
+int is_match(mit_t *mit, intptr_t id, const char *name) {
+  mit_result_t *res = mit_next(mit);
+  mit_pair_t *pair = res->value;
+  struct row *r;
+  if (res->status != MIT_OK) { return 0; }
+  r = pair->first;
+  return MIT_INT(pair->second) == id && r->id == id
+      && strcmp(r->name, name) == 0;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  struct records build, probe;
+  struct lines left, right;
+  int i = 0, c = 0, ok = 1;
+  mit_result_t *res;
+  mit_pair_t *pair;
+  void *values[8];
+  mit_t *mit;
+  size_t n, got;
+
+  tap_plan(22);
+
+  /* duplicates on the build side are returned in build order */
+  mit = mit_hash_join(mit_new(rowfn, &i, freefn), mit_new(probefn, &c, NULL),
+          idfn, NULL, NULL);
+  tap_ok(is_match(mit, 1, "one"), "first match");
+  tap_is_int(freed, 1, "build side freed once drained");
+  tap_ok(is_match(mit, 1, "uno"), "second duplicate");
+  tap_ok(is_match(mit, 1, "eins"), "third duplicate");
+  tap_is_int(count, 1, "probe pulled after its matches");
+  tap_ok(is_match(mit, 2, "two"), "single match");
+  tap_ok(is_match(mit, 3, "three") && is_match(mit, 1, "one"),
+      "unmatched probe values skipped");
+  tap_ok(is_match(mit, 1, "uno") && is_match(mit, 1, "eins"),
+      "repeated probe value");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "join exhausted");
+  mit_free(mit);
+
+  /* sized values on both sides, copied out of reused buffers */
+  build.i = probe.i = 0;
+  build.n = 10000;
+  build.step = 10;
+  probe.n = 100000;
+  probe.step = 1;
+  mit = mit_hash_join(mit_sized_new(recordfn, &build, NULL),
+          mit_sized_new(recordfn, &probe, NULL), NULL, NULL, NULL);
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    pair = res->value;
+    if (pair->firstlen != pair->secondlen
+        || memcmp(pair->first, pair->second, pair->firstlen) != 0
+        || pair->first == (void *)build.buf) {
+      ok = 0;
+    }
+  }
+  tap_is_int(n, 10000, "sized matches");
+  tap_ok(ok, "sized pairs");
+  tap_is_int(res->status, MIT_EXHAUSTED, "sized join exhausted");
+  mit_free(mit);
+
+  /* empty keys match each other wherever the records are */
+  left.text = text1;
+  right.text = text2;
+  left.i = right.i = 0;
+  mit = mit_hash_join(mit_sized_new(linefn, &left, NULL),
+          mit_sized_new(linefn, &right, NULL), NULL, NULL, NULL);
+  ok = 1;
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    pair = res->value;
+    if (pair->firstlen != pair->secondlen
+        || memcmp(pair->first, pair->second, pair->firstlen) != 0) {
+      ok = 0;
+    }
+  }
+  tap_is_int(n, 14, "empty keys matched");
+  tap_ok(ok, "empty key pairs");
+  mit_free(mit);
+
+  /* the pair is reused, so a batch holds a single match */
+  mit = mit_hash_join(mit_range(0, 4, 1), mit_range(0, 4, 1),
+          NULL, NULL, NULL);
+  ok = 1;
+  for (n = 0; (got = mit_next_batch(mit, values, 8)) > 0; n++) {
+    pair = values[0];
+    if (got != 1 || pair->first != pair->second
+        || MIT_INT(pair->second) != (intptr_t)n) {
+      ok = 0;
+    }
+  }
+  tap_is_int(n, 4, "batches of matches");
+  tap_ok(ok, "batched pairs");
+  mit_free(mit);
+
+  /* empty and failing build sides */
+  c = count = freed = 0;
+  mit = mit_hash_join(mit_range(0, 0, 1), mit_new(probefn, &c, freefn),
+          NULL, NULL, NULL);
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "empty build side");
+  tap_ok(count == 0 && freed == 1, "probe side freed without being read");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED,
+      "empty join stays exhausted");
+  mit_free(mit);
+
+  c = 0;
+  mit = mit_hash_join(mit_new(errfn, &c, NULL), mit_range(0, 1000, 1),
+          NULL, NULL, NULL);
+  tap_is_int(mit_next(mit)->status, MIT_ERROR, "build side error");
+  mit_free(mit);
+
+  c = 0;
+  mit = mit_hash_join(mit_range(0, 1000, 1), mit_new(errfn, &c, NULL),
+          NULL, NULL, NULL);
+  for (n = 0; mit_next(mit)->status == MIT_OK; n++);
+  tap_ok(n == 10 && mit_is_error(mit), "probe side error");
+  mit_free(mit);
+
+  tap_is_int(live(), 0, "all memory released");
+
+  return tap_finish();
+}
@@ -0,0 +1,135 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define NSHARDS 256
+#define SHARD 100
+
+struct item {
+  int key;
+  int shard;
+};
+
+unsigned long comparisons = 0;
+
+int cmpfn(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  intptr_t x = MIT_INT(a->value), y = MIT_INT(b->value);
+  (void)ctx;
+  comparisons++;
+  return x < y ? -1 : x > y;
+}
+
+int itemcmp(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  const struct item *x = a->value, *y = b->value;
+  (void)ctx;
+  return x->key - y->key;
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 2) { return MIT_ERROR; }
+  *result = MIT_PTR(*c);
+  return MIT_OK;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  static void *shards[NSHARDS][SHARD];
+  static struct item items[4][8];
+  void *small[3][3] = {
+    { MIT_PTR(1), MIT_PTR(4), MIT_PTR(7) },
+    { MIT_PTR(2), MIT_PTR(3) },
+    { MIT_PTR(0), MIT_PTR(5), MIT_PTR(6) },
+  };
+  mit_t *mits[NSHARDS];
+  mit_result_t *res;
+  size_t i, j, count = 0, remaining;
+  intptr_t prev = -1;
+  int sorted = 1, stable = 1, ctx = 0;
+  struct item *last = NULL;
+  unsigned long seed = 1;
+  mit_t *mit;
+
+  tap_plan(15);
+
+  /* a few small inputs */
+  mits[0] = mit_from_array(small[0], 3);
+  mits[1] = mit_from_array(small[1], 2);
+  mits[2] = mit_from_array(small[2], 3);
+  mit = mit_merge_sorted(mits, 3, cmpfn, NULL, 0);
+  tap_ok(mit_is_finite(mit), "merge of finite inputs is finite");
+  tap_is_int(mit_size_hint(mit, &remaining), 1, "size known");
+  tap_is_int(remaining, 8, "size of all inputs");
+  for (i = 0; i < 5; i++) {
+    sorted = sorted && MIT_INT(mit_next(mit)->value) == (intptr_t)i;
+  }
+  tap_ok(sorted, "values merged in order");
+  tap_is_int(live(), 3, "exhausted input released");
+  while (mit_next(mit)->status == MIT_OK) { count++; }
+  tap_is_int(count, 3, "remaining values");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "merge exhausted");
+  tap_is_int(live(), 1, "every input released");
+  mit_free(mit);
+
+  /* many shards, few comparisons per value */
+  for (i = 0; i < NSHARDS; i++) {
+    intptr_t v = 0;
+    for (j = 0; j < SHARD; j++) {
+      seed = seed * 1103515245 + 12345;
+      v += (seed >> 16) % 1000;
+      shards[i][j] = MIT_PTR(v);
+    }
+    mits[i] = mit_from_array(shards[i], SHARD);
+  }
+  sorted = 1;
+  count = 0;
+  comparisons = 0;
+  mit = mit_merge_sorted(mits, NSHARDS, cmpfn, NULL, 0);
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    sorted = sorted && MIT_INT(res->value) >= prev;
+    prev = MIT_INT(res->value);
+    count++;
+  }
+  tap_ok(sorted, "shards merged in order");
+  tap_is_int(count, NSHARDS * SHARD, "every value merged");
+  tap_ok(comparisons <= (unsigned long)NSHARDS * SHARD * 9,
+      "at most log2(k) + 1 comparisons per value");
+  mit_free(mit);
+
+  /* stable mode keeps equal values in input order */
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 8; j++) {
+      items[i][j].key = (int)(j / (i + 1));
+      items[i][j].shard = (int)i;
+    }
+    mits[i] = mit_from_strided(items[i], 8, sizeof(struct item));
+  }
+  mit = mit_merge_sorted(mits, 4, itemcmp, NULL, 1);
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    struct item *it = res->value;
+    if (last && last->key == it->key && last->shard > it->shard) { stable = 0; }
+    last = it;
+  }
+  tap_ok(stable, "equal values in input order");
+  mit_free(mit);
+
+  /* empty merges and errors */
+  mit = mit_merge_sorted(mits, 0, cmpfn, NULL, 0);
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "merge of nothing");
+  mit_free(mit);
+
+  mits[0] = mit_range(0, 10, 1);
+  mits[1] = mit_new(errfn, &ctx, NULL);
+  mit = mit_merge_sorted(mits, 2, cmpfn, NULL, 0);
+  while (mit_next(mit)->status == MIT_OK) { count++; }
+  tap_is_int(mit_status(mit), MIT_ERROR, "input error passed through");
+  mit_free(mit);
+  tap_is_int(live(), 0, "inputs freed with the merge");
+
+  return tap_finish();
+}
@@ -0,0 +1,96 @@
+#define MIT_THREADS
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+const int limit = 10000;
+int freed = 0;
+
+void freefn(void *v) {
+  (void)v;
+  ++freed;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= limit) { return MIT_EXHAUSTED; }
+  else { ++(*c); *result = (void *)(intptr_t) * c; return MIT_OK; }
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 100) { return MIT_ERROR; }
+  *result = (void *)(intptr_t) * c;
+  return MIT_OK;
+}
+
+mit_status_t mapfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  if ((intptr_t)value == -1) { return MIT_ERROR; }
+  *result = (void *)((intptr_t)value * 2);
+  return MIT_OK;
+}
+
+mit_status_t failfn(void *value, void *ctx, void **result) {
+  if ((intptr_t)value == *(int *)ctx) { return MIT_ERROR; }
+  *result = value;
+  return MIT_OK;
+}
+
+int main(void) {
+  int ctx = 0, count = 0, ordered = 1, fail = 5000;
+  long long sum = 0;
+  mit_result_t *res;
+  mit_t *mit;
+
+  tap_plan(13);
+
+  /* ordered */
+  mit = mit_par_map(mit_new(nextfn, &ctx, freefn), mapfn, NULL, 4, 1);
+  tap_ok(mit != NULL, "parallel map created");
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    ordered = ordered && (intptr_t)res->value == 2 * ++count;
+  }
+  tap_ok(ordered, "values returned in source order");
+  tap_is_int(count, limit, "all values returned");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "iterator exhausted");
+  mit_free(mit);
+  tap_is_int(freed, 1, "wrapped iterator freed");
+
+  /* unordered */
+  ctx = count = 0;
+  mit = mit_par_map(mit_new(nextfn, &ctx, NULL), mapfn, NULL, 3, 0);
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    sum += (intptr_t)res->value;
+    ++count;
+  }
+  tap_is_int(count, limit, "unordered returns all values");
+  tap_ok(sum == (long long)limit * (limit + 1), "unordered values mapped");
+  mit_free(mit);
+
+  /* map errors */
+  ctx = count = 0;
+  mit = mit_par_map(mit_new(nextfn, &ctx, NULL), failfn, &fail, 4, 1);
+  while (mit_next(mit)->status == MIT_OK) { ++count; }
+  tap_is_int(count, fail - 1, "values before the error returned in order");
+  tap_is_int(mit_status(mit), MIT_ERROR, "map error propagated");
+  mit_free(mit);
+
+  ctx = count = 0;
+  mit = mit_par_map(mit_new(nextfn, &ctx, NULL), failfn, &fail, 4, 0);
+  while (mit_next(mit)->status == MIT_OK) { ++count; }
+  tap_ok(count < limit, "unordered map stops at the error");
+  tap_is_int(mit_status(mit), MIT_ERROR, "unordered map error propagated");
+  mit_free(mit);
+
+  /* source errors */
+  ctx = count = 0;
+  mit = mit_par_map(mit_new(errfn, &ctx, NULL), mapfn, NULL, 2, 1);
+  while (mit_next(mit)->status == MIT_OK) { ++count; }
+  tap_is_int(count, 100, "values before source error returned");
+  tap_is_int(mit_status(mit), MIT_ERROR, "source error propagated");
+  mit_free(mit);
+
+  return tap_finish();
+}
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#define MIT_THREADS
+#define MIT_POSIX
+
+#include <time.h>
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+const int limit = 10000;
+int freed = 0;
+
+void freefn(void *v) {
+  (void)v;
+  ++freed;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= limit) { return MIT_EXHAUSTED; }
+  else { ++(*c); *result = (void *)(intptr_t) * c; return MIT_OK; }
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 3) { return MIT_ERROR; }
+  *result = (void *)(intptr_t) * c;
+  return MIT_OK;
+}
+
+mit_status_t grepfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = !((intptr_t)value % 2);
+  return MIT_OK;
+}
+
+/* write a record to the channel for each value, closing it at the end */
+int writerfn(mit_t *mit, mit_result_t *res, void *ctx) {
+  int *fd = ctx;
+  (void)mit;
+  if (res->status != MIT_OK) {
+    close(*fd);
+    return 0;
+  }
+  return write(*fd, "record\n", 7) != 7;
+}
+
+int readerfn(mit_t *mit, mit_result_t *res, void *ctx) {
+  int *received = ctx;
+  (void)mit;
+  if (res->status == MIT_OK) { ++(*received); }
+  else if (res->status == MIT_ERROR) { *received = -1; }
+  return 0;
+}
+
+int main(void) {
+  int ctx = 0, count = 0, ordered = 1;
+  void *values[64];
+  mit_result_t *res;
+  size_t got, total = 0;
+  struct timespec pause = { 0, 20000000 };
+  int n;
+  mit_t *mit;
+
+  tap_plan(20);
+
+  /* values arrive in order */
+  mit = mit_prefetch(mit_new(nextfn, &ctx, freefn), 8);
+  tap_ok(mit != NULL, "prefetch iterator created");
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    ordered = ordered && (intptr_t)res->value == ++count;
+  }
+  tap_ok(ordered, "values returned in order");
+  tap_is_int(count, limit, "all values returned");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "exhaustion passed through");
+  mit_free(mit);
+  tap_is_int(freed, 1, "wrapped iterator freed");
+
+  /* batches through an adapter */
+  ctx = 0;
+  mit = mit_grep(mit_prefetch(mit_new(nextfn, &ctx, NULL), 100), grepfn,
+          NULL, NULL);
+  while ((got = mit_next_batch(mit, values, 64)) > 0) { total += got; }
+  tap_is_int(total, limit / 2, "batches pulled through prefetch");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "batch exhaustion");
+  mit_free(mit);
+
+  /* errors */
+  ctx = 0;
+  mit = mit_prefetch(mit_new(errfn, &ctx, NULL), 2);
+  tap_is_int(mit_skip(mit, 3), MIT_OK, "values before error returned");
+  tap_is_int(mit_next(mit)->status, MIT_ERROR, "error passed through");
+  tap_is_int(mit_status(mit), MIT_ERROR, "error status set");
+  mit_free(mit);
+
+  /* freeing a running prefetch stops the producer */
+  ctx = 0;
+  freed = 0;
+  mit = mit_prefetch(mit_new(nextfn, &ctx, freefn), 4);
+  tap_is_int((intptr_t)mit_next(mit)->value, 1, "first value");
+  mit_free(mit);
+  tap_is_int(freed, 1, "wrapped iterator freed after stopping");
+
+  /* a take above a prefetch stops it with the last value, but the source
+   * is kept until the next retrieval */
+  ctx = 0;
+  freed = 0;
+  mit = mit_take(mit_grep(mit_prefetch(mit_new(nextfn, &ctx, freefn), 64),
+              grepfn, NULL, NULL), 5);
+  tap_is_int(mit_skip(mit, 4), MIT_OK, "values before limit");
+  tap_is_int((intptr_t)mit_next(mit)->value, 10, "last value");
+  n = ctx;
+  nanosleep(&pause, NULL);
+  tap_ok(ctx == n && freed == 0, "producer stopped at limit");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "exhausted after limit");
+  tap_is_int(freed, 1, "source released on the next retrieval");
+  mit_free(mit);
+
+  /* a prefetch over a pending source is pending itself, so an event loop
+   * services other iterators while its thread waits */
+  {
+    int fds[2], received = 0;
+    mit_loop_t *loop = mit_loop_new();
+    tap_ok(pipe(fds) == 0
+        && fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK) == 0,
+        "channel opened");
+    mit_loop_add(loop, mit_prefetch(mit_from_fd(fds[0], '\n', 64), 4),
+        readerfn, &received);
+    mit_loop_add(loop, mit_range(0, 3, 1), writerfn, &fds[1]);
+    tap_is_int(mit_loop_run(loop), 0, "loop finished");
+    tap_is_int(received, 3, "records read through prefetch in a loop");
+    mit_loop_free(loop);
+    close(fds[0]);
+  }
+
+  return tap_finish();
+}
@@ -0,0 +1,198 @@
+#define _POSIX_C_SOURCE 200809L
+#define MIT_POSIX
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define N 100000
+
+struct item {
+  int key;
+  int seq;
+};
+
+struct records {
+  char buf[16];       /* reused for every record */
+  int i;
+};
+
+int intcmp(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  intptr_t x = MIT_INT(a->value), y = MIT_INT(b->value);
+  (void)ctx;
+  return x < y ? -1 : x > y;
+}
+
+int itemcmp(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  const struct item *x = a->value, *y = b->value;
+  (void)ctx;
+  return x->key - y->key;
+}
+
+int bytecmp(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  size_t n = a->len < b->len ? a->len : b->len;
+  int c = memcmp(a->value, b->value, n);
+  (void)ctx;
+  return c ? c : (a->len > b->len) - (a->len < b->len);
+}
+
+unsigned long seed = 1;
+
+mit_status_t randfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > N) { return MIT_EXHAUSTED; }
+  seed = seed * 1103515245 + 12345;
+  *result = MIT_PTR((seed >> 16) % 50000);
+  return MIT_OK;
+}
+
+mit_status_t recordfn(void *ctx, void **result, size_t *len) {
+  struct records *r = ctx;
+  if (r->i >= 1000) { return MIT_EXHAUSTED; }
+  *len = (size_t)sprintf(r->buf, "r%d", (r->i * 7919) % 1000);
+  r->i++;
+  *result = r->buf;
+  return MIT_OK;
+}
+
+/* every third record is empty */
+mit_status_t emptyfn(void *ctx, void **result, size_t *len) {
+  struct records *r = ctx;
+  if (r->i >= 1000) { return MIT_EXHAUSTED; }
+  *len = r->i % 3 ? (size_t)sprintf(r->buf, "r%d", r->i) : 0;
+  r->i++;
+  *result = r->buf;
+  return MIT_OK;
+}
+
+/* empty records sort first and must not point into the source's buffer */
+size_t empties(mit_t *mit, struct records *rec) {
+  mit_result_t *res;
+  size_t n = 0;
+  while ((res = mit_next(mit))->status == MIT_OK && res->len == 0) {
+    if ((char *)res->value >= rec->buf
+        && (char *)res->value < rec->buf + sizeof(rec->buf)) {
+      return 0;
+    }
+    n++;
+  }
+  return n;
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 5000) { return MIT_ERROR; }
+  *result = MIT_PTR(*c);
+  return MIT_OK;
+}
+
+size_t runs(mit_t *mit) {
+  struct _mit_sort_ctx_t *s = mit_ctx(mit);
+  return s->nruns;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  static struct item items[N];
+  char dir[] = "/tmp/mit-sort-test-XXXXXX", prev[16] = "";
+  int ctx = 0, sorted = 1, stable = 1;
+  struct records rec;
+  struct item *last = NULL;
+  mit_result_t *res;
+  size_t count = 0, remaining, i;
+  intptr_t v = -1;
+  mit_t *mit;
+
+  tap_plan(22);
+
+  /* small inputs stay in memory */
+  mit = mit_sort(mit_range(10, 0, -1), intcmp, NULL, 0, NULL);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 1, "smallest value first");
+  tap_is_int(runs(mit), 0, "nothing spilled");
+  tap_is_int(mit_size_hint(mit, &remaining), 1, "size known in memory");
+  tap_is_int(remaining, 9, "remaining values");
+  mit_free(mit);
+
+  mit = mit_sort(mit_range(0, 0, 1), intcmp, NULL, 0, NULL);
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "empty input");
+  mit_free(mit);
+
+  /* larger inputs are spilled to runs in tmpdir and merged */
+  tap_ok(mkdtemp(dir) != NULL, "temporary directory created");
+  mit = mit_sort(mit_new(randfn, &ctx, NULL), intcmp, NULL, 64 << 10, dir);
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    sorted = sorted && MIT_INT(res->value) >= v;
+    v = MIT_INT(res->value);
+    count++;
+  }
+  tap_ok(runs(mit) > 10, "input spilled to runs");
+  tap_ok(sorted, "spilled values sorted");
+  tap_is_int(count, N, "every value returned");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "sort exhausted");
+  mit_free(mit);
+  tap_ok(rmdir(dir) == 0, "no files left behind");
+
+  /* sized values are copied out of the source's buffer */
+  memset(&rec, 0, sizeof(rec));
+  mit = mit_sort(mit_finite_sized_new(recordfn, &rec, NULL), bytecmp, NULL,
+          4 << 10, NULL);
+  sorted = 1;
+  count = 0;
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    char cur[16];
+    memcpy(cur, res->value, res->len);
+    cur[res->len] = '\0';
+    sorted = sorted && strcmp(prev, cur) < 0;
+    memcpy(prev, cur, sizeof(prev));
+    count++;
+  }
+  tap_ok(runs(mit) > 1, "records spilled");
+  tap_ok(sorted, "records sorted with their contents");
+  tap_is_int(count, 1000, "every record returned");
+  mit_free(mit);
+
+  /* empty records are copied as well */
+  memset(&rec, 0, sizeof(rec));
+  mit = mit_sort(mit_finite_sized_new(emptyfn, &rec, NULL), bytecmp, NULL,
+          0, NULL);
+  tap_is_int(empties(mit, &rec), 334, "empty records copied");
+  mit_free(mit);
+
+  memset(&rec, 0, sizeof(rec));
+  mit = mit_sort(mit_finite_sized_new(emptyfn, &rec, NULL), bytecmp, NULL,
+          4 << 10, NULL);
+  tap_is_int(empties(mit, &rec), 334, "empty records spilled");
+  tap_ok(runs(mit) > 1, "records with empty ones spilled");
+  mit_free(mit);
+
+  /* equal values keep their input order across runs */
+  for (i = 0; i < N; i++) {
+    items[i].key = (int)(i * 31 % 97);
+    items[i].seq = (int)i;
+  }
+  mit = mit_sort(mit_from_strided(items, N, sizeof(struct item)), itemcmp,
+          NULL, 32 << 10, NULL);
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    struct item *it = res->value;
+    if (last && last->key == it->key && last->seq > it->seq) { stable = 0; }
+    last = it;
+  }
+  tap_ok(runs(mit) > 1, "items spilled");
+  tap_ok(stable, "sort is stable");
+  mit_free(mit);
+
+  /* errors after spilling */
+  ctx = 0;
+  mit = mit_sort(mit_new(errfn, &ctx, NULL), intcmp, NULL, 16 << 10, NULL);
+  tap_is_int(mit_next(mit)->status, MIT_ERROR, "input error passed through");
+  tap_ok(runs(mit) > 0, "error after spilling");
+  mit_free(mit);
+  tap_is_int(live(), 0, "all memory released");
+
+  return tap_finish();
+}
@@ -0,0 +1,146 @@
+#define MIT_THREADS
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+int freed = 0;
+
+void freefn(void *v) {
+  (void)v;
+  ++freed;
+}
+
+mit_status_t nextfn(void *ctx, void **result) {
+  int *c = ctx;
+  *result = MIT_PTR(++(*c));
+  return MIT_OK;
+}
+
+mit_status_t lessfn(void *value, void *ctx, int *matches) {
+  *matches = MIT_INT(value) < *(int *)ctx;
+  return MIT_OK;
+}
+
+mit_status_t failfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = 1;
+  return MIT_INT(value) == 3 ? MIT_ERROR : MIT_OK;
+}
+
+/* a source returning pointers into its own buffer, poisoned when freed */
+struct owner {
+  int values[8];
+  int i;
+};
+
+mit_status_t ownerfn(void *ctx, void **result) {
+  struct owner *o = ctx;
+  if (o->i >= 8) { return MIT_EXHAUSTED; }
+  *result = &o->values[o->i++];
+  return MIT_OK;
+}
+
+void ownerfree(void *ctx) {
+  memset(ctx, 0xff, sizeof(struct owner));
+  ++freed;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  struct owner owner = { { 10, 11, 12, 13, 14, 15, 16, 17 }, 0 };
+  int ctx = 0, limit = 3;
+  void *values[64];
+  size_t remaining;
+  mit_t *mit;
+
+  tap_plan(35);
+
+  /* an infinite source is released once the limit is passed */
+  mit = mit_take(mit_new(nextfn, &ctx, freefn), 3);
+  tap_ok(mit_is_finite(mit), "take is finite");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 1, "value 1");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 2, "value 2");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 3, "value 3");
+  tap_is_int(freed, 0, "source kept while its last value may be in use");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "exhausted after limit");
+  tap_is_int(freed, 1, "source released at exhaustion");
+  tap_is_int(live(), 1, "only the take iterator left");
+  mit_free(mit);
+  tap_is_int(freed, 1, "source not freed twice");
+
+  /* sources whose values outlive them are released with the last value */
+  mit = mit_take(mit_range(0, 100, 1), 2);
+  tap_is_int(mit_size_hint(mit, &remaining), 1, "size known");
+  tap_is_int(remaining, 2, "size limited by take");
+  mit_next(mit);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 1, "last value");
+  tap_is_int(live(), 1, "range released immediately");
+  mit_free(mit);
+
+  /* batches and skips stop at the limit */
+  mit = mit_take(mit_range(0, 100, 1), 10);
+  tap_is_int(mit_skip(mit, 2), MIT_OK, "values skipped");
+  tap_is_int(mit_next_batch(mit, values, 64), 8, "batch limited");
+  tap_is_int(MIT_INT(values[7]), 9, "last batch value");
+  tap_is_int(mit_next_batch(mit, values, 64), 0, "no values after limit");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "batch exhausted");
+  mit_free(mit);
+
+  mit = mit_take(mit_range(0, 100, 1), 0);
+  tap_is_int(live(), 1, "source released by an empty take");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "empty take exhausted");
+  mit_free(mit);
+
+  /* take_while releases its source at the first rejected value */
+  ctx = 0;
+  freed = 0;
+  mit = mit_take_while(mit_new(nextfn, &ctx, freefn), lessfn, &limit, freefn);
+  tap_is_int(mit_skip(mit, 2), MIT_OK, "matching values");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "rejected value ends");
+  tap_is_int(freed, 1, "source released");
+  mit_free(mit);
+  tap_is_int(freed, 2, "predicate context freed");
+
+  mit = mit_take_while(mit_range(0, 100, 1), lessfn, &limit, NULL);
+  tap_is_int(mit_next_batch(mit, values, 64), 3, "batch cut at rejected value");
+  tap_is_int(mit_next_batch(mit, values, 64), 0, "nothing after cut");
+  mit_free(mit);
+
+  /* skip_while drops the leading matches only */
+  mit = mit_skip_while(mit_from_array((void *[]) {
+    MIT_PTR(1), MIT_PTR(2), MIT_PTR(5), MIT_PTR(1)
+  }, 4), lessfn, &limit, NULL);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 5, "first value kept");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 1, "later matches kept");
+  mit_free(mit);
+
+  limit = 60;
+  mit = mit_skip_while(mit_range(0, 100, 1), lessfn, &limit, NULL);
+  tap_is_int(mit_next_batch(mit, values, 32), 4, "batch after skipped batch");
+  tap_is_int(MIT_INT(values[0]), 60, "batch starts at first kept value");
+  mit_free(mit);
+
+  mit = mit_take_while(mit_range(0, 100, 1), failfn, NULL, NULL);
+  tap_is_int(mit_skip(mit, 5), MIT_ERROR, "predicate error");
+  mit_free(mit);
+
+  /* values from a prefetch are not assumed to outlive their source */
+  freed = 0;
+  mit = mit_take(mit_prefetch(mit_new(ownerfn, &owner, ownerfree), 4), 3);
+  mit_next(mit);
+  mit_next(mit);
+  tap_is_int(*(int *)mit_next(mit)->value, 12,
+      "last value valid below a prefetch");
+  tap_is_int(freed, 0, "prefetched source kept with the last value");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "prefetch take exhausted");
+  tap_is_int(freed, 1, "prefetched source released");
+  mit_free(mit);
+
+  return tap_finish();
+}
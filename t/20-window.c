@@ -0,0 +1,200 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+/* every other call is pending */
+mit_status_t waitfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c >= 20) { return MIT_EXHAUSTED; }
+  if ((*c)++ % 2 == 0) { return MIT_PENDING; }
+  *result = MIT_PTR(*c / 2);
+  return MIT_OK;
+}
+
+mit_status_t errfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (++(*c) > 5) { return MIT_ERROR; }
+  *result = MIT_PTR(*c);
+  return MIT_OK;
+}
+
+/* sized values whose length is one more than their number */
+mit_status_t sizedfn(void *ctx, void **result, size_t *len) {
+  static char text[] = "abcdefghijklmnopqrstuvwxyz";
+  int *c = ctx;
+  if (*c >= 20) { return MIT_EXHAUSTED; }
+  *result = text;
+  *len = (size_t)++(*c);
+  return MIT_OK;
+}
+
+/* the lengths of the window returned last count up from first */
+int is_lens(mit_t *mit, size_t first, size_t count) {
+  size_t *wlens = mit_window_lens(mit), i;
+  if (wlens == NULL) { return 0; }
+  for (i = 0; i < count; i++) {
+    if (wlens[i] != first + i) { return 0; }
+  }
+  return 1;
+}
+
+/* the view holds count values counting up from first */
+int is_view(mit_result_t *res, intptr_t first, size_t count) {
+  void **view = res->value;
+  size_t i;
+  if (res->status != MIT_OK || res->len != count * sizeof(void *)) {
+    return 0;
+  }
+  for (i = 0; i < count; i++) {
+    if (MIT_INT(view[i]) != first + (intptr_t)i) { return 0; }
+  }
+  return 1;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  int ctx = 0, ok = 1;
+  mit_result_t *res;
+  size_t remaining, n, got, lens[8];
+  void *view, *values[8];
+  mit_t *mit;
+
+  tap_plan(32);
+
+  /* chunks, the last one short */
+  mit = mit_chunk(mit_range(0, 10, 1), 4);
+  tap_ok(mit_size_hint(mit, &remaining) && remaining == 3, "chunk count");
+  res = mit_next(mit);
+  view = res->value;
+  tap_ok(is_view(res, 0, 4), "first chunk");
+  tap_ok(mit_size_hint(mit, &remaining) && remaining == 2, "chunks left");
+  res = mit_next(mit);
+  tap_ok(is_view(res, 4, 4), "second chunk");
+  tap_ok(res->value == view, "buffer reused");
+  tap_ok(is_view(mit_next(mit), 8, 2), "short last chunk");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "chunks exhausted");
+  mit_free(mit);
+
+  mit = mit_chunk(mit_range(0, 8, 1), 4);
+  mit_next(mit);
+  tap_ok(is_view(mit_next(mit), 4, 4), "exact last chunk");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "no empty chunk");
+  mit_free(mit);
+
+  /* the ring is reused, so a batch holds a single chunk */
+  mit = mit_chunk(mit_range(0, 12, 1), 4);
+  ok = 1;
+  for (n = 0; (got = mit_next_batch_sized(mit, values, lens, 8)) > 0; n++) {
+    mit_result_t batch;
+    batch.status = MIT_OK;
+    batch.value = values[0];
+    batch.len = lens[0];
+    if (got != 1 || !is_view(&batch, (intptr_t)(n * 4), 4)) { ok = 0; }
+  }
+  tap_is_int(n, 3, "batches of chunks");
+  tap_ok(ok, "batched chunks");
+  mit_free(mit);
+  ok = 1;
+
+  /* sliding windows wrap around the ring */
+  mit = mit_window(mit_range(0, 7, 1), 3, 1);
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    if (!is_view(res, (intptr_t)n, 3)) { ok = 0; }
+  }
+  tap_is_int(n, 5, "full windows only");
+  tap_ok(ok, "windows slide by one");
+  mit_free(mit);
+
+  mit = mit_window(mit_range(0, 9, 1), 3, 2);
+  tap_ok(is_view(mit_next(mit), 0, 3) && is_view(mit_next(mit), 2, 3)
+      && is_view(mit_next(mit), 4, 3) && is_view(mit_next(mit), 6, 3),
+      "overlapping windows");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "partial window dropped");
+  mit_free(mit);
+
+  mit = mit_window(mit_range(0, 20, 1), 2, 5);
+  tap_ok(is_view(mit_next(mit), 0, 2) && is_view(mit_next(mit), 5, 2)
+      && is_view(mit_next(mit), 10, 2) && is_view(mit_next(mit), 15, 2),
+      "values between windows skipped");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "gapped windows exhausted");
+  mit_free(mit);
+
+  mit = mit_window(mit_range(0, 2, 1), 3, 1);
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "input shorter than window");
+  mit_free(mit);
+
+  ok = 1;
+  mit = mit_window(mit_range(0, 10000, 1), 7, 3);
+  for (n = 0; (res = mit_next(mit))->status == MIT_OK; n++) {
+    if (!is_view(res, (intptr_t)(n * 3), 7)) { ok = 0; }
+  }
+  tap_ok(ok && n == (10000 - 7) / 3 + 1, "many windows");
+  mit_free(mit);
+
+  /* lengths of sized values */
+  mit = mit_window(mit_range(0, 5, 1), 2, 1);
+  mit_next(mit);
+  tap_ok(mit_window_lens(mit) == NULL, "no lengths for unsized input");
+  mit_free(mit);
+
+  ctx = 0;
+  mit = mit_chunk(mit_finite_sized_new(sizedfn, &ctx, NULL), 8);
+  tap_ok(mit_window_lens(mit) == NULL, "no lengths before a chunk");
+  mit_next(mit);
+  mit_next(mit);
+  tap_ok(is_lens(mit, 9, 8), "chunk lengths");
+  mit_next(mit);
+  tap_ok(is_lens(mit, 17, 4), "short chunk lengths");
+  mit_free(mit);
+
+  ctx = 0;
+  ok = 1;
+  mit = mit_window(mit_finite_sized_new(sizedfn, &ctx, NULL), 3, 1);
+  for (n = 0; mit_next(mit)->status == MIT_OK; n++) {
+    if (!is_lens(mit, n + 1, 3)) { ok = 0; }
+  }
+  tap_ok(ok && n == 18, "window lengths slide with the window");
+  mit_free(mit);
+  ctx = 0;
+  ok = 1;
+
+  /* pending and failing input */
+  mit = mit_chunk(mit_new(waitfn, &ctx, NULL), 3);
+  ok = 1;
+  for (n = 0; (res = mit_next(mit))->status != MIT_EXHAUSTED;) {
+    if (res->status == MIT_PENDING) { continue; }
+    if (!is_view(res, (intptr_t)(n * 3 + 1), n < 3 ? 3 : 1)) { ok = 0; }
+    n++;
+  }
+  tap_is_int(n, 4, "chunks across pending input");
+  tap_ok(ok, "chunks resumed after pending");
+  mit_free(mit);
+
+  ctx = 0;
+  mit = mit_window(mit_new(waitfn, &ctx, NULL), 4, 6);
+  tap_is_int(mit_next(mit)->status, MIT_PENDING, "window pending");
+  while ((res = mit_next(mit))->status == MIT_PENDING);
+  tap_ok(is_view(res, 1, 4), "window after pending");
+  while ((res = mit_next(mit))->status == MIT_PENDING);
+  tap_ok(is_view(res, 7, 4), "skip resumed after pending");
+  mit_free(mit);
+
+  ctx = 0;
+  mit = mit_chunk(mit_new(errfn, &ctx, NULL), 4);
+  mit_next(mit);
+  tap_is_int(mit_next(mit)->status, MIT_ERROR, "input error");
+  mit_free(mit);
+
+  mit = mit_range(0, 1, 1);
+  tap_ok(mit_chunk(mit, 0) == NULL, "empty chunks rejected");
+  mit_free(mit);
+
+  tap_is_int(live(), 0, "all memory released");
+
+  return tap_finish();
+}
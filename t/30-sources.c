@@ -0,0 +1,71 @@
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+struct point {
+  int x, y;
+};
+
+int main(void) {
+  char a[] = "a", b[] = "b", c[] = "c";
+  void *array[] = { a, b, c }, *values[8], *base;
+  char *strv[] = { a, b, c, NULL };
+  struct point points[4] = { { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 } };
+  size_t size, stride;
+  mit_t *mit;
+
+  tap_plan(27);
+
+  /* array */
+  mit = mit_from_array(array, 3);
+  tap_ok(mit_is_finite(mit), "array is finite");
+  tap_ok(mit_size_hint(mit, &size) && size == 3, "array size");
+  tap_ok(mit_next(mit)->value == a, "array value 1");
+  tap_ok(mit_peek(mit)->value == b, "array peek");
+  tap_ok(mit_contiguous(mit, &base, &size, &stride), "array is contiguous");
+  tap_ok(base == &array[1] && size == 2 && stride == sizeof(void *),
+      "contiguous storage includes peeked value");
+  tap_is_int(mit_next_batch(mit, values, 8), 1, "peeked value returned");
+  tap_is_int(mit_next_batch(mit, values, 8), 1, "batch copies the rest");
+  tap_ok(values[0] == c, "array batch value");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "array exhausted");
+  mit_free(mit);
+
+  /* strv */
+  mit = mit_from_strv(strv);
+  tap_ok(mit_size_hint(mit, &size) && size == 3, "strv size");
+  tap_is_str(mit_nth(mit, 2)->value, "c", "strv nth");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "strv exhausted");
+  mit_free(mit);
+
+  /* strided */
+  mit = mit_from_strided(&points[0].y, 4, sizeof(struct point));
+  tap_is_int(*(int *)mit_next(mit)->value, 1, "strided value 1");
+  tap_is_int(mit_skip(mit, 1), MIT_OK, "strided skip");
+  tap_is_int(mit_next_batch(mit, values, 8), 2, "strided batch");
+  tap_ok(values[0] == &points[2].y && values[1] == &points[3].y,
+      "strided batch values");
+  mit_free(mit);
+
+  /* range */
+  mit = mit_range(0, 10, 3);
+  tap_ok(mit_size_hint(mit, &size) && size == 4, "range size");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 0, "range value 1");
+  tap_is_int(MIT_INT(mit_nth(mit, 1)->value), 6, "range nth");
+  tap_is_int(mit_next_batch(mit, values, 8), 1, "range batch");
+  tap_is_int(MIT_INT(values[0]), 9, "range batch value");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "range exhausted");
+  mit_free(mit);
+
+  mit = mit_range(5, -5, -5);
+  tap_ok(mit_size_hint(mit, &size) && size == 2, "descending range size");
+  tap_is_int(MIT_INT(mit_nth(mit, 1)->value), 0, "descending range value");
+  mit_free(mit);
+
+  mit = mit_range(5, 5, 1);
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "empty range");
+  tap_ok(!mit_contiguous(mit, &base, &size, &stride), "range not contiguous");
+  mit_free(mit);
+
+  return tap_finish();
+}
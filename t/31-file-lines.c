@@ -0,0 +1,91 @@
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#define MIT_POSIX
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+char path[] = "/tmp/mit-file-lines-XXXXXX";
+
+void write_file(const char *contents, size_t len) {
+  FILE *f = fopen(path, "w");
+  fwrite(contents, 1, len, f);
+  fclose(f);
+}
+
+int is_record(void *value, size_t len, const char *expected) {
+  return len == strlen(expected) && memcmp(value, expected, len) == 0;
+}
+
+int is_next(mit_t *mit, const char *expected) {
+  mit_result_t *res = mit_next(mit);
+  return res->status == MIT_OK && is_record(res->value, res->len, expected);
+}
+
+mit_status_t grepfn(void *value, size_t len, void *ctx, int *matches) {
+  (void)value;
+  (void)ctx;
+  *matches = len > 0;
+  return MIT_OK;
+}
+
+int main(void) {
+  void *values[8];
+  size_t lens[8];
+  mit_t *mit;
+  int fd;
+
+  tap_plan(20);
+
+  fd = mkstemp(path);
+  close(fd);
+
+  /* lines */
+  write_file("alpha\nbeta\n\ngamma", 17);
+  mit = mit_from_file_lines(path, '\n');
+  tap_ok(mit != NULL, "file opened");
+  tap_ok(mit_is_finite(mit), "file iterator is finite");
+  tap_ok(is_next(mit, "alpha"), "line 1");
+  tap_ok(is_next(mit, "beta"), "line 2");
+  tap_ok(is_next(mit, ""), "empty line");
+  tap_ok(is_next(mit, "gamma"), "unterminated final line");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "file exhausted");
+  mit_free(mit);
+
+  /* terminated final record, batches, skips and adapters */
+  write_file("a\0bb\0\0ccc\0dddd\0", 15);
+  mit = mit_grep_sized(mit_from_file_lines(path, '\0'), grepfn, NULL, NULL);
+  tap_is_int(mit_next_batch_sized(mit, values, lens, 8), 4, "batch of non-empty records");
+  tap_ok(is_record(values[0], lens[0], "a"), "batch value 1");
+  tap_ok(is_record(values[2], lens[2], "ccc"), "batch value 3");
+  tap_ok(is_record(values[3], lens[3], "dddd"), "no record after final delimiter");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "batch exhausted file");
+  mit_free(mit);
+
+  mit = mit_from_file_lines(path, '\0');
+  tap_is_int(mit_skip(mit, 3), MIT_OK, "records skipped");
+  tap_ok(is_next(mit, "ccc"), "value after skip");
+  tap_is_int(mit_skip(mit, 3), MIT_EXHAUSTED, "skip past end");
+  mit_free(mit);
+
+  /* empty and missing files */
+  write_file("", 0);
+  mit = mit_from_file_lines(path, '\n');
+  tap_ok(mit != NULL, "empty file opened");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "empty file has no records");
+  mit_free(mit);
+
+  unlink(path);
+  errno = 0;
+  tap_ok(mit_from_file_lines(path, '\n') == NULL, "missing file");
+  tap_is_int(errno, ENOENT, "errno set");
+
+  {
+    size_t allocs, deallocs;
+    mit_alloc_counts(&allocs, &deallocs);
+    tap_is_int(allocs, deallocs, "all iterators released");
+  }
+
+  return tap_finish();
+}
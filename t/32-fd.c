@@ -0,0 +1,71 @@
+#define _POSIX_C_SOURCE 200809L
+#define MIT_POSIX
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+int is_record(void *value, size_t len, const char *expected) {
+  return len == strlen(expected) && memcmp(value, expected, len) == 0;
+}
+
+int is_next(mit_t *mit, const char *expected) {
+  mit_result_t *res = mit_next(mit);
+  return res->status == MIT_OK && is_record(res->value, res->len, expected);
+}
+
+int pipe_from(const char *contents) {
+  int fds[2];
+  if (pipe(fds) != 0) { return -1; }
+  if (write(fds[1], contents, strlen(contents)) < 0) { return -1; }
+  close(fds[1]);
+  return fds[0];
+}
+
+int main(void) {
+  size_t allocs, deallocs;
+  void *values[8];
+  size_t lens[8];
+  mit_t *mit;
+  int fd;
+
+  tap_plan(18);
+
+  /* records spanning reads, and a record larger than the buffer */
+  fd = pipe_from("ab\ncdef\n\nghijklmnopq\nr");
+  mit = mit_from_fd(fd, '\n', 4);
+  tap_ok(mit != NULL, "iterator created");
+  tap_ok(is_next(mit, "ab"), "record 1");
+  tap_ok(is_next(mit, "cdef"), "record across reads");
+  tap_ok(is_next(mit, ""), "empty record");
+  tap_ok(is_next(mit, "ghijklmnopq"), "record grows buffer");
+  tap_ok(is_next(mit, "r"), "unterminated final record");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "input exhausted");
+  mit_free(mit);
+  close(fd);
+
+  /* batches only return buffered records */
+  fd = pipe_from("a,b,c,d,e,f,");
+  mit = mit_from_fd(fd, ',', 0);
+  tap_is_int(mit_skip(mit, 1), MIT_OK, "record skipped");
+  tap_is_int(mit_next_batch_sized(mit, values, lens, 3), 3, "batch of records");
+  tap_ok(is_record(values[0], lens[0], "b"), "batch value 1");
+  tap_ok(is_record(values[2], lens[2], "d"), "batch value 3");
+  tap_is_int(mit_next_batch_sized(mit, values, lens, 8), 2, "rest of input");
+  tap_ok(is_record(values[1], lens[1], "f"), "no record after final delimiter");
+  tap_is_int(mit_next_batch_sized(mit, values, lens, 8), 0, "batch at end of input");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "batch exhausted input");
+  mit_free(mit);
+  close(fd);
+
+  /* read errors */
+  mit = mit_from_fd(-1, '\n', 0);
+  tap_is_int(mit_next(mit)->status, MIT_ERROR, "read error");
+  tap_is_int(errno, EBADF, "errno preserved");
+  mit_free(mit);
+
+  mit_alloc_counts(&allocs, &deallocs);
+  tap_is_int(allocs, deallocs, "buffers released");
+
+  return tap_finish();
+}
@@ -0,0 +1,115 @@
+#define _XOPEN_SOURCE 600
+#define MIT_UCONTEXT
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define NNODES 2000
+
+struct node {
+  intptr_t value;
+  struct node *left, *right;
+};
+
+/* stackless generator: every second value from 0 to limit, twice */
+struct pairs {
+  mit_gen_t gen;
+  intptr_t i, limit;
+  int pass;
+};
+
+mit_status_t pairsfn(void *ctx, void **result) {
+  struct pairs *p = ctx;
+  MIT_GEN_BEGIN(&p->gen);
+  for (p->pass = 0; p->pass < 2; p->pass++) {
+    for (p->i = 0; p->i < p->limit; p->i += 2) {
+      MIT_YIELD(&p->gen, result, MIT_PTR(p->i));
+    }
+  }
+  MIT_GEN_END(&p->gen);
+}
+
+/* fiber generator: recursive in-order tree walk */
+int walk(mit_fiber_t *fiber, struct node *n) {
+  if (n == NULL) { return 1; }
+  return walk(fiber, n->left)
+      && mit_fiber_yield(fiber, MIT_PTR(n->value))
+      && walk(fiber, n->right);
+}
+
+int walk_done = 0;
+
+mit_status_t walkfn(mit_fiber_t *fiber, void *ctx) {
+  walk(fiber, ctx);
+  walk_done++;
+  return MIT_EXHAUSTED;
+}
+
+mit_status_t failfn(mit_fiber_t *fiber, void *ctx) {
+  mit_fiber_yield(fiber, ctx);
+  return MIT_ERROR;
+}
+
+mit_status_t oddfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = MIT_INT(value) % 2;
+  return MIT_OK;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  static struct node nodes[NNODES];
+  struct pairs p = { MIT_GEN_INIT, 0, 5, 0 };
+  mit_t *mit;
+  intptr_t i, sum = 0, expected = 0;
+
+  tap_plan(16);
+
+  /* stackless */
+  mit = mit_chain(mit_new(pairsfn, &p, NULL), mit_range(100, 101, 1));
+  tap_is_int(MIT_INT(mit_next(mit)->value), 0, "generator value 1");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 2, "generator value 2");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 4, "generator value 3");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 0, "generator resumes outer loop");
+  tap_is_int(mit_skip(mit, 2), MIT_OK, "generator values skipped");
+  tap_is_int(MIT_INT(mit_next(mit)->value), 100, "generator exhausted in chain");
+  tap_is_int(p.gen.resume, -1, "generator finished");
+  mit_free(mit);
+
+  /* degenerate tree deeper than the default stack would allow */
+  for (i = 0; i < NNODES; i++) {
+    nodes[i].value = i;
+    nodes[i].left = i + 1 < NNODES ? &nodes[i + 1] : NULL;
+    expected += i % 2 ? i : 0;
+  }
+  mit = mit_fiber_new(walkfn, &nodes[0], NULL, 1 << 20);
+  tap_is_int(MIT_INT(mit_next(mit)->value), NNODES - 1, "deepest node first");
+  mit_free(mit);
+  tap_is_int(walk_done, 1, "stopped producer returns");
+  tap_is_int(live(), 0, "fiber stack released");
+
+  mit = mit_grep(mit_fiber_new(walkfn, &nodes[0], NULL, 1 << 20),
+          oddfn, NULL, NULL);
+  while (mit_next(mit)->status == MIT_OK) { sum += MIT_INT(mit->value.value); }
+  tap_is_int(sum, expected, "walk through grep");
+  tap_is_int(mit_status(mit), MIT_EXHAUSTED, "walk exhausted");
+  tap_is_int(walk_done, 2, "walk completed");
+  mit_free(mit);
+
+  /* errors and unstarted generators */
+  mit = mit_fiber_new(failfn, MIT_PTR(7), NULL, 0);
+  tap_is_int(MIT_INT(mit_next(mit)->value), 7, "value before error");
+  tap_is_int(mit_next(mit)->status, MIT_ERROR, "producer error");
+  mit_free(mit);
+
+  mit_free(mit_fiber_new(failfn, NULL, NULL, 0));
+  tap_is_int(live(), 0, "unstarted fiber released");
+
+  return tap_finish();
+}
@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#define MIT_POSIX
+
+#include <sys/socket.h>
+
+#include "../ext/tap.c/tap.c"
+
+#include "mIterator.c"
+
+#define NRELAY 200
+
+int is_next(mit_t *mit, const char *expected) {
+  mit_result_t *res = mit_next(mit);
+  return res->status == MIT_OK && res->len == strlen(expected)
+      && memcmp(res->value, expected, res->len) == 0;
+}
+
+int nonblocking(int fd) {
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/* a pipe or socket pair with a non-blocking read end */
+int channel(int fds[2], int socket) {
+  if (socket ? socketpair(AF_UNIX, SOCK_STREAM, 0, fds) : pipe(fds)) {
+    return -1;
+  }
+  return nonblocking(fds[0]);
+}
+
+mit_status_t waitfn(void *ctx, void **result) {
+  int *c = ctx;
+  if (*c == 0) { return MIT_EXHAUSTED; }
+  if ((*c)-- % 2) { return MIT_PENDING; }
+  *result = ctx;
+  return MIT_OK;
+}
+
+/* pending once, then counts up to 100 */
+struct once {
+  int pending;
+  int i;
+};
+
+mit_status_t oncefn(void *ctx, void **result) {
+  struct once *o = ctx;
+  if (o->pending) {
+    o->pending = 0;
+    return MIT_PENDING;
+  }
+  if (o->i >= 100) { return MIT_EXHAUSTED; }
+  *result = MIT_PTR(++o->i);
+  return MIT_OK;
+}
+
+mit_status_t onceskipfn(void *ctx, size_t n, size_t *skipped) {
+  struct once *o = ctx;
+  *skipped = 0;
+  if (o->pending) {
+    o->pending = 0;
+    return MIT_PENDING;
+  }
+  o->i += (int)n;
+  *skipped = n;
+  return MIT_OK;
+}
+
+mit_status_t highfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = MIT_INT(value) >= 90;
+  return MIT_OK;
+}
+
+int waitfd(void *ctx) {
+  (void)ctx;
+  return 42;
+}
+
+mit_status_t grepfn(void *value, size_t len, void *ctx, int *matches) {
+  (void)value;
+  (void)ctx;
+  *matches = len > 1;
+  return MIT_OK;
+}
+
+/* every relay forwards its records to the next channel */
+struct relay {
+  int in[2];
+  int out;
+  int received;
+  int finished;
+};
+
+struct relay relays[NRELAY];
+
+int relayfn(mit_t *mit, mit_result_t *res, void *ctx) {
+  struct relay *r = ctx;
+  (void)mit;
+  if (res->status != MIT_OK) {
+    r->finished = res->status == MIT_EXHAUSTED ? 1 : -1;
+    if (r->out >= 0) { close(r->out); }
+    return 0;
+  }
+  r->received++;
+  if (r->out >= 0) {
+    if (write(r->out, res->value, res->len) < 0 || write(r->out, "\n", 1) < 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int stopfn(mit_t *mit, mit_result_t *res, void *ctx) {
+  int *count = ctx;
+  (void)mit;
+  if (res->status != MIT_OK) {
+    *count = -1;
+    return 0;
+  }
+  return ++(*count) == 100;
+}
+
+int statusfn(mit_t *mit, mit_result_t *res, void *ctx) {
+  (void)mit;
+  *(mit_status_t *)ctx = res->status;
+  return 0;
+}
+
+size_t live(void) {
+  size_t allocs, deallocs;
+  mit_alloc_counts(&allocs, &deallocs);
+  return allocs - deallocs;
+}
+
+int main(void) {
+  int fds[2], ok = 1, stopped = 0, ctx = 4;
+  mit_status_t status = MIT_OK;
+  void *values[4];
+  mit_loop_t *loop;
+  mit_t *mit, *src;
+  size_t i;
+
+  struct once once = { 1, 0 };
+
+  tap_plan(36);
+
+  /* a non-blocking descriptor with no input is pending */
+  channel(fds, 0);
+  mit = mit_from_fd(fds[0], '\n', 0);
+  tap_is_int(mit_peek(mit)->status, MIT_PENDING, "peek pending");
+  tap_is_int(mit_next(mit)->status, MIT_PENDING, "next pending");
+  tap_ok(mit_is_pending(mit) && !mit_is_ready(mit), "iterator pending");
+  tap_is_int(mit_pending_fd(mit), fds[0], "pending descriptor");
+  tap_ok(write(fds[1], "a\nb", 3) == 3, "input written");
+  tap_ok(is_next(mit, "a"), "value after pending");
+  tap_ok(mit_is_ready(mit), "iterator ready again");
+  tap_is_int(mit_next(mit)->status, MIT_PENDING, "partial record pending");
+  tap_ok(write(fds[1], "\n", 1) == 1, "record completed");
+  close(fds[1]);
+  tap_ok(is_next(mit, "b"), "completed record");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "closed input exhausted");
+  mit_free(mit);
+  close(fds[0]);
+
+  /* pending sources inside grep and chain */
+  channel(fds, 1);
+  src = mit_from_fd(fds[0], '\n', 0);
+  mit = mit_chain(mit_grep_sized(src, grepfn, NULL, NULL), mit_range(0, 1, 1));
+  tap_is_int(mit_next(mit)->status, MIT_PENDING, "chain of grep pending");
+  tap_is_int(mit_pending_fd(mit), fds[0], "descriptor of inner source");
+  tap_ok(write(fds[1], "x\nyz\n", 5) == 5, "input written");
+  tap_ok(is_next(mit, "yz"), "filtered value after pending");
+  tap_is_int(mit_next_batch(mit, values, 4), 0, "empty batch while pending");
+  tap_is_int(mit_status(mit), MIT_PENDING, "batch left iterator pending");
+  shutdown(fds[1], SHUT_WR);
+  tap_is_int(mit_next_batch(mit, values, 4), 1, "batch from next source");
+  tap_is_int(mit_next(mit)->status, MIT_EXHAUSTED, "chain exhausted");
+  mit_free(mit);
+  close(fds[0]);
+  close(fds[1]);
+
+  /* pending user callbacks and skips */
+  mit = mit_new(waitfn, &ctx, NULL);
+  mit_set_fdfn(mit, waitfd);
+  tap_is_int(mit_skip(mit, 2), MIT_PENDING, "skip interrupted by pending");
+  tap_is_int(mit_pending_fd(mit), 42, "descriptor from callback");
+  tap_is_int(mit_skip(mit, 1), MIT_OK, "skip resumed");
+  mit_free(mit);
+
+  /* a batch or skip that succeeds after pending clears the status */
+  mit = mit_new(oncefn, &once, NULL);
+  tap_is_int(mit_next_batch(mit, values, 4), 0, "batch pending");
+  tap_is_int(mit_next_batch(mit, values, 4), 4, "batch after pending");
+  tap_ok(mit_is_ready(mit) && !mit_is_pending(mit), "batch cleared pending");
+  mit_free(mit);
+
+  once.pending = 1;
+  once.i = 0;
+  mit = mit_new(oncefn, &once, NULL);
+  mit_set_skipfn(mit, onceskipfn);
+  tap_is_int(mit_skip(mit, 3), MIT_PENDING, "skipfn pending");
+  tap_is_int(mit_skip(mit, 3), MIT_OK, "skipfn after pending");
+  tap_ok(mit_is_ready(mit) && !mit_is_pending(mit), "skip cleared pending");
+  mit_free(mit);
+
+  once.pending = 1;
+  once.i = 0;
+  mit = mit_grep(mit_new(oncefn, &once, NULL), highfn, NULL, NULL);
+  mit_next_batch(mit, values, 4);
+  tap_ok(mit_next_batch(mit, values, 4) > 0, "filtered batch after pending");
+  tap_is_int(MIT_INT(values[0]), 90, "values past a rejected batch");
+  mit_free(mit);
+
+  /* one loop servicing a ring of relays over pipes and socket pairs */
+  tap_ok((loop = mit_loop_new()) != NULL, "loop created");
+  for (i = 0; i < NRELAY; i++) {
+    if (channel(relays[i].in, i % 2) != 0) { ok = 0; }
+    relays[i].out = -1;
+  }
+  for (i = 0; i < NRELAY; i++) {
+    relays[i].out = i + 1 < NRELAY ? relays[i + 1].in[1] : -1;
+    mit = mit_from_fd(relays[i].in[0], '\n', 0);
+    if (mit_loop_add(loop, mit, relayfn, &relays[i]) != 0) { ok = 0; }
+  }
+  mit_loop_add(loop, mit_range(0, 1000, 1), stopfn, &stopped);
+  ctx = 1;
+  mit = mit_new(waitfn, &ctx, NULL);
+  mit_loop_add(loop, mit, statusfn, &status);
+  if (write(relays[0].in[1], "first\nsecond\n", 13) != 13) { ok = 0; }
+  close(relays[0].in[1]);
+  tap_is_int(mit_loop_run(loop), 0, "loop finished");
+  for (i = 0; i < NRELAY; i++) {
+    if (relays[i].received != 2 || relays[i].finished != 1) { ok = 0; }
+    close(relays[i].in[0]);
+  }
+  tap_ok(ok, "records passed through every relay");
+  tap_is_int(stopped, 100, "callback stopped pipeline");
+  tap_is_int(status, MIT_ERROR, "pending without descriptor fails");
+  mit_loop_free(loop);
+  tap_is_int(live(), 0, "all memory released");
+
+  return tap_finish();
+}
@@ -0,0 +1,541 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mIterator.c"
+
+/* usage: bench [-n elements] [-r runs] [-o out.json] [-c baseline.json]
+ *              [-t tolerance]
+ *
+ * Reports the cost per element of the core operations.  Results are written
+ * as JSON with -o; with -c every case is compared against a saved run and
+ * the exit status is non-zero if any case is slower by more than the
+ * tolerance (a fraction, default 0.25) or a saved case was not run. */
+
+#define MAX_CASES 64
+#define MAX_DEPTH 16
+
+struct result {
+  char name[32];
+  double ns;
+  double allocs;
+};
+
+static struct result results[MAX_CASES];
+static size_t nresults = 0;
+static size_t limit = 10 * 1000 * 1000;
+static void **array;
+static volatile uintptr_t sink;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static size_t allocs(void) {
+  size_t count;
+  mit_alloc_counts(&count, NULL);
+  return count;
+}
+
+/**********
+ * inputs *
+ *********/
+
+struct counter {
+  size_t i;
+  size_t n;
+};
+
+static mit_status_t countfn(void *ctx, void **result) {
+  struct counter *c = ctx;
+  if (c->i >= c->n) { return MIT_EXHAUSTED; }
+  *result = (void *)(uintptr_t)c->i++;
+  return MIT_OK;
+}
+
+static mit_status_t countbatchfn(void *ctx, void **values, size_t n,
+    size_t *count) {
+  struct counter *c = ctx;
+  size_t i;
+  if (n > c->n - c->i) { n = c->n - c->i; }
+  for (i = 0; i < n; i++) { values[i] = (void *)(uintptr_t)c->i++; }
+  *count = n;
+  return c->i < c->n ? MIT_OK : MIT_EXHAUSTED;
+}
+
+static mit_status_t evenfn(void *value, void *ctx, int *matches) {
+  (void)ctx;
+  *matches = !((uintptr_t)value & 1);
+  return MIT_OK;
+}
+
+static mit_status_t evenbatchfn(void **values, size_t n, void *ctx,
+    unsigned char *selected) {
+  size_t i;
+  (void)ctx;
+  for (i = 0; i < n; i++) { selected[i] = !((uintptr_t)values[i] & 1); }
+  return MIT_OK;
+}
+
+static mit_status_t incfn(void *value, void *ctx, void **result) {
+  (void)ctx;
+  *result = (void *)((uintptr_t)value + 1);
+  return MIT_OK;
+}
+
+static int cmpfn(const mit_result_t *a, const mit_result_t *b, void *ctx) {
+  uintptr_t x = (uintptr_t)a->value, y = (uintptr_t)b->value;
+  (void)ctx;
+  return x < y ? -1 : x > y;
+}
+
+/*********
+ * cases *
+ ********/
+
+typedef size_t (*bench_fn_t)(size_t arg);
+
+static size_t drain(mit_t *mit) {
+  uintptr_t sum = 0;
+  size_t count = 0;
+  mit_result_t *res;
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    sum += (uintptr_t)res->value;
+    count++;
+  }
+  sink = sum;
+  mit_free(mit);
+  return count;
+}
+
+static size_t bench_loop(size_t arg) {
+  uintptr_t sum = 0;
+  size_t i;
+  (void)arg;
+  for (i = 0; i < limit; i++) {
+    sum += i;
+    __asm__ __volatile__("" : "+r"(sum));
+  }
+  sink = sum;
+  return limit;
+}
+
+static size_t bench_raw(size_t arg) {
+  struct counter c = { 0, 0 };
+  (void)arg;
+  c.n = limit;
+  return drain(mit_new(countfn, &c, NULL));
+}
+
+static size_t bench_batch(size_t arg) {
+  struct counter c = { 0, 0 };
+  void *values[256];
+  uintptr_t sum = 0;
+  size_t got, i, count = 0;
+  mit_t *mit;
+  c.n = limit;
+  mit = mit_new(countfn, &c, NULL);
+  while ((got = mit_next_batch(mit, values, arg)) > 0) {
+    for (i = 0; i < got; i++) { sum += (uintptr_t)values[i]; }
+    count += got;
+  }
+  sink = sum;
+  mit_free(mit);
+  return count;
+}
+
+/* drain the built-in sources one value at a time (arg 0) or arg values at
+ * a time */
+static size_t drain_source(mit_t *mit, size_t arg) {
+  void *values[256];
+  uintptr_t sum = 0;
+  size_t got, i, count = 0;
+  if (arg == 0) { return drain(mit); }
+  while ((got = mit_next_batch(mit, values, arg)) > 0) {
+    for (i = 0; i < got; i++) { sum += (uintptr_t)values[i]; }
+    count += got;
+  }
+  sink = sum;
+  mit_free(mit);
+  return count;
+}
+
+static size_t bench_range(size_t arg) {
+  return drain_source(mit_range(0, (intptr_t)limit, 1), arg);
+}
+
+static size_t bench_array(size_t arg) {
+  return drain_source(mit_from_array(array, limit), arg);
+}
+
+static size_t bench_grep(size_t arg) {
+  struct counter c = { 0, 0 };
+  (void)arg;
+  c.n = limit;
+  drain(mit_grep(mit_new(countfn, &c, NULL), evenfn, NULL, NULL));
+  return limit;
+}
+
+/* drain a filter in batches of 64; arg selects a per-value (0) or batch (1)
+ * predicate */
+static size_t bench_grep_batch(size_t arg) {
+  struct counter c = { 0, 0 };
+  void *values[64];
+  uintptr_t sum = 0;
+  size_t got, i;
+  mit_t *mit;
+  c.n = limit;
+  mit = mit_new(countfn, &c, NULL);
+  mit_set_batchfn(mit, countbatchfn);
+  mit = arg ? mit_grep_batch(mit, evenbatchfn, NULL, NULL)
+      : mit_grep(mit, evenfn, NULL, NULL);
+  while ((got = mit_next_batch(mit, values, 64)) > 0) {
+    for (i = 0; i < got; i++) { sum += (uintptr_t)values[i]; }
+  }
+  sink = sum;
+  mit_free(mit);
+  return limit;
+}
+
+static size_t bench_map(size_t arg) {
+  struct counter c = { 0, 0 };
+  (void)arg;
+  c.n = limit;
+  return drain(mit_map(mit_new(countfn, &c, NULL), incfn, NULL, NULL));
+}
+
+static size_t bench_chain(size_t arg) {
+  static struct counter c[1000];
+  static mit_t *mits[1000];
+  size_t i;
+  for (i = 0; i < arg; i++) {
+    c[i].i = 0;
+    c[i].n = limit / arg;
+    mits[i] = mit_new(countfn, &c[i], NULL);
+  }
+  return drain(mit_chain_n(mits, arg));
+}
+
+/* merge arg interleaved ranges */
+static size_t bench_merge(size_t arg) {
+  static mit_t *mits[1000];
+  size_t i;
+  for (i = 0; i < arg; i++) {
+    mits[i] = mit_range((intptr_t)i, (intptr_t)limit, (intptr_t)arg);
+  }
+  return drain(mit_merge_sorted(mits, arg, cmpfn, NULL, 0));
+}
+
+static mit_status_t modfn(void *value, void *ctx, void **result) {
+  *result = MIT_PTR(MIT_INT(value) % (intptr_t)(size_t)ctx);
+  return MIT_OK;
+}
+
+/* deduplicate a range folded onto arg keys */
+static size_t bench_distinct(size_t arg) {
+  mit_t *mit = mit_map(mit_range(0, (intptr_t)limit, 1), modfn,
+          (void *)arg, NULL);
+  drain(mit_distinct(mit, NULL, NULL, NULL));
+  return limit;
+}
+
+static mit_status_t keyfn(void *value, size_t len, void *ctx,
+    void **key, size_t *keylen) {
+  (void)len;
+  *key = MIT_PTR(MIT_INT(value) % (intptr_t)(size_t)ctx);
+  *keylen = 0;
+  return MIT_OK;
+}
+
+static mit_status_t tallyfn(void *acc, void *value, size_t len, void *ctx,
+    void **result) {
+  (void)value;
+  (void)len;
+  (void)ctx;
+  *result = MIT_PTR(MIT_INT(acc) + 1);
+  return MIT_OK;
+}
+
+/* count a range by arg keys */
+static size_t bench_group(size_t arg) {
+  drain(mit_group_aggregate(mit_range(0, (intptr_t)limit, 1), keyfn, NULL,
+          tallyfn, (void *)arg, NULL));
+  return limit;
+}
+
+/* join a range against arg build values */
+static size_t bench_join(size_t arg) {
+  drain(mit_hash_join(mit_range(0, (intptr_t)arg, 1),
+          mit_range(0, (intptr_t)limit, 1), NULL, NULL, NULL));
+  return limit;
+}
+
+/* values arg at a time */
+static size_t bench_chunk(size_t arg) {
+  return drain(mit_chunk(mit_range(0, (intptr_t)limit, 1), arg)) * arg;
+}
+
+/* sum windows of arg values sliding by one */
+static size_t bench_window(size_t arg) {
+  mit_t *mit = mit_window(mit_range(0, (intptr_t)limit, 1), arg, 1);
+  mit_result_t *res;
+  uintptr_t sum = 0;
+  while ((res = mit_next(mit))->status == MIT_OK) {
+    sum += (uintptr_t)((void **)res->value)[arg - 1];
+  }
+  sink = sum;
+  mit_free(mit);
+  return limit;
+}
+
+static size_t bench_depth(size_t arg) {
+  struct counter c = { 0, 0 };
+  mit_t *mit;
+  size_t i;
+  c.n = limit;
+  mit = mit_new(countfn, &c, NULL);
+  for (i = 0; i < arg; i++) {
+    mit = i % 2 ? mit_grep(mit, evenfn, NULL, NULL)
+        : mit_map(mit, incfn, NULL, NULL);
+  }
+  drain(mit);
+  return limit;
+}
+
+static size_t bench_peek(size_t arg) {
+  struct counter c = { 0, 0 };
+  uintptr_t sum = 0;
+  size_t count = 0;
+  mit_t *mit;
+  (void)arg;
+  c.n = limit;
+  mit = mit_new(countfn, &c, NULL);
+  while (mit_peek(mit)->status == MIT_OK) {
+    sum += (uintptr_t)mit_peek(mit)->value;
+    sum += (uintptr_t)mit_next(mit)->value;
+    count++;
+  }
+  sink = sum;
+  mit_free(mit);
+  return count;
+}
+
+/* take every arg-th value */
+static size_t nth(mit_t *mit, size_t arg) {
+  uintptr_t sum = 0;
+  mit_result_t *res;
+  while ((res = mit_nth(mit, arg - 1))->status == MIT_OK) {
+    sum += (uintptr_t)res->value;
+  }
+  sink = sum;
+  mit_free(mit);
+  return limit;
+}
+
+static size_t bench_nth(size_t arg) {
+  struct counter c = { 0, 0 };
+  c.n = limit;
+  return nth(mit_new(countfn, &c, NULL), arg);
+}
+
+static size_t bench_nth_range(size_t arg) {
+  return nth(mit_range(0, (intptr_t)limit, 1), arg);
+}
+
+static size_t bench_nth_array(size_t arg) {
+  return nth(mit_from_array(array, limit), arg);
+}
+
+/* a pure map over a range skips without calling the map */
+static size_t bench_nth_pure(size_t arg) {
+  return nth(mit_map_pure(mit_range(0, (intptr_t)limit, 1), incfn, NULL,
+          NULL), arg);
+}
+
+/* build and drain many short grep/map/chain pipelines; arg selects heap
+ * (0) or arena (1) allocation */
+static size_t bench_pipelines(size_t arg) {
+  struct counter c = { 0, 0 };
+  mit_arena_t *arena = arg ? mit_arena_new(4096) : NULL;
+  size_t i, count = limit / 100;
+  for (i = 0; i < count; i++) {
+    mit_t *mit;
+    c.i = 0;
+    c.n = 1;
+    mit = mit_new_in(arena, countfn, &c, NULL);
+    mit = mit_map(mit_grep(mit, evenfn, NULL, NULL), incfn, NULL, NULL);
+    mit = mit_chain(mit, mit_new_in(arena, countfn, &c, NULL));
+    drain(mit);
+  }
+  mit_arena_free(arena);
+  return count;
+}
+
+static void run(const char *name, bench_fn_t fn, size_t arg, int runs) {
+  struct result *r = &results[nresults++];
+  double best = 0;
+  size_t a = 0;
+  int i;
+  for (i = 0; i < runs; i++) {
+    size_t before = allocs(), count;
+    double start = now(), elapsed;
+    count = fn(arg);
+    elapsed = (now() - start) / (count ? count : 1);
+    if (i == 0 || elapsed < best) { best = elapsed; }
+    a = allocs() - before;
+  }
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->ns = best;
+  r->allocs = (double)a;
+  printf("%-20s %10.3f ns/element %10zu allocations\n", r->name, r->ns, a);
+}
+
+/********
+ * json *
+ *******/
+
+static int write_json(const char *path) {
+  FILE *f = fopen(path, "w");
+  size_t i;
+  if (f == NULL) {
+    fprintf(stderr, "unable to open '%s' (%s)\n", path, strerror(errno));
+    return -1;
+  }
+  fprintf(f, "{\n  \"elements\": %zu,\n  \"cases\": [\n", limit);
+  for (i = 0; i < nresults; i++) {
+    fprintf(f, "    {\"name\": \"%s\", \"ns_per_element\": %.4f,"
+        " \"allocations\": %.0f}%s\n", results[i].name, results[i].ns,
+        results[i].allocs, i + 1 < nresults ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  return fclose(f);
+}
+
+static int compare(const char *path, double tolerance) {
+  FILE *f = fopen(path, "r");
+  char line[256];
+  int failed = 0;
+  if (f == NULL) {
+    fprintf(stderr, "unable to open '%s' (%s)\n", path, strerror(errno));
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f)) {
+    struct result base;
+    size_t i;
+    int found = 0;
+    if (sscanf(line, " {\"name\": \"%31[^\"]\", \"ns_per_element\": %lf,"
+            " \"allocations\": %lf}", base.name, &base.ns, &base.allocs) != 3) {
+      continue;
+    }
+    for (i = 0; i < nresults; i++) {
+      struct result *r = &results[i];
+      if (strcmp(r->name, base.name) != 0) { continue; }
+      found = 1;
+      if (r->ns > base.ns * (1 + tolerance) || r->allocs > base.allocs) {
+        printf("REGRESSION %-20s %10.3f ns (baseline %.3f)"
+            " %10.0f allocations (baseline %.0f)\n",
+            r->name, r->ns, base.ns, r->allocs, base.allocs);
+        failed = 1;
+      }
+    }
+    /* a renamed or dropped case would otherwise hide its regressions */
+    if (!found) {
+      printf("MISSING    %-20s not run (baseline %.3f ns)\n", base.name,
+          base.ns);
+      failed = 1;
+    }
+  }
+  fclose(f);
+  return failed;
+}
+
+int main(int argc, char *argv[]) {
+  const char *out = NULL, *baseline = NULL;
+  double tolerance = 0.25;
+  int runs = 3, i;
+  size_t j;
+  char name[32];
+
+  for (i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-n") == 0) {
+      limit = strtoul(argv[i + 1], NULL, 10);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      runs = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-o") == 0) {
+      out = argv[i + 1];
+    } else if (strcmp(argv[i], "-c") == 0) {
+      baseline = argv[i + 1];
+    } else if (strcmp(argv[i], "-t") == 0) {
+      tolerance = strtod(argv[i + 1], NULL);
+    } else {
+      fprintf(stderr, "unknown option '%s'\n", argv[i]);
+      return 2;
+    }
+  }
+
+  if ((array = malloc(limit * sizeof(*array))) == NULL) {
+    fprintf(stderr, "unable to allocate %zu values\n", limit);
+    return 2;
+  }
+  for (j = 0; j < limit; j++) { array[j] = MIT_PTR(j); }
+
+  run("loop", bench_loop, 0, runs);
+  run("raw", bench_raw, 0, runs);
+  run("batch-64", bench_batch, 64, runs);
+  run("range", bench_range, 0, runs);
+  run("range-batch-64", bench_range, 64, runs);
+  run("array", bench_array, 0, runs);
+  run("array-batch-64", bench_array, 64, runs);
+  run("grep", bench_grep, 0, runs);
+  run("grep-batch-64", bench_grep_batch, 0, runs);
+  run("grep-select-64", bench_grep_batch, 1, runs);
+  run("map", bench_map, 0, runs);
+  run("chain-2", bench_chain, 2, runs);
+  run("chain-1000", bench_chain, 1000, runs);
+  run("merge-2", bench_merge, 2, runs);
+  run("merge-256", bench_merge, 256, runs);
+  run("distinct-1k", bench_distinct, 1000, runs);
+  run("distinct-1m", bench_distinct, 1000000, runs);
+  run("group-1k", bench_group, 1000, runs);
+  run("join-1k", bench_join, 1000, runs);
+  run("chunk-64", bench_chunk, 64, runs);
+  run("window-16", bench_window, 16, runs);
+  for (i = 1; i <= MAX_DEPTH; i++) {
+    snprintf(name, sizeof(name), "depth-%d", i);
+    run(name, bench_depth, i, runs);
+  }
+  run("peek", bench_peek, 0, runs);
+  run("nth-10", bench_nth, 10, runs);
+  run("nth-1000", bench_nth, 1000, runs);
+  run("nth-range-1000", bench_nth_range, 1000, runs);
+  run("nth-array-1000", bench_nth_array, 1000, runs);
+  run("nth-pure-1000", bench_nth_pure, 1000, runs);
+  run("pipeline-heap", bench_pipelines, 0, runs);
+  run("pipeline-arena", bench_pipelines, 1, runs);
+
+  free(array);
+
+  if (out && write_json(out) != 0) { return 1; }
+  if (baseline) {
+    switch (compare(baseline, tolerance)) {
+      case 0:
+        printf("no regressions against %s\n", baseline);
+        break;
+      case 1:
+        return 1;
+      default:
+        return 2;
+    }
+  }
+
+  return 0;
+}
+
+/* vim: set ts=2 sw=2 et: */